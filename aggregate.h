@@ -0,0 +1,274 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include "model.h"
+#include "pool.h"
+
+namespace model
+{
+    // A value per node summarizing its subtree, such as a descendant count
+    // or a total size: the node's own value combined with the totals of its
+    // children.  'combine' must be associative and commutative, with
+    // 'identity' as its neutral element.  Totals are stored by node id and
+    // kept up to date from the model's change lists by fixing up only the
+    // ancestors of what changed.  Given 'remove', which takes a part back
+    // out of a total, each ancestor costs one step, so an update is
+    // O(depth); without it each ancestor is combined again from its
+    // children.
+    template <typename T>
+    class aggregate
+    {
+    public:
+        typedef std::function<T(node const&)> own_function;
+        typedef std::function<T(T const&, T const&)> combine_function;
+
+    private:
+        own_function _own;
+        combine_function _combine;
+        combine_function _remove;
+        T _identity;
+
+        std::vector<T> _totals;
+        std::vector<uint8_t> _known;
+
+        parallel::thread_pool& _pool;
+
+        void reserve(uint32_t id)
+        {
+            if (id < _totals.size()) return;
+            _totals.resize((size_t)id + 1 + id / 2, _identity);
+            _known.resize(_totals.size(), 0);
+        }
+
+        bool known(node const& n) const
+        {
+            return n.id < _known.size() && _known[n.id] != 0;
+        }
+
+        // Combines the node's own value with its children's totals.  In a
+        // batch, children whose insert comes later in the change list are
+        // not known yet; that insert adds them.
+        T combine_children(node const& n) const
+        {
+            auto total = _own(n);
+            for (auto& c : n.children)
+                if (known(c)) total = _combine(total, _totals[c.id]);
+            return total;
+        }
+
+        // Totals of the subtree of 'n', children before their parent.  The
+        // tree is walked with a stack rather than by recursion, since it
+        // may nest deeper than the call stack allows; an entry is visited
+        // once on the way down and, marked done, once on the way up.
+        void compute(node const& n)
+        {
+            std::vector<std::pair<node const*, bool> > stack(1, std::make_pair(&n, false));
+
+            while (!stack.empty())
+            {
+                auto top = stack.back();
+                stack.pop_back();
+
+                auto& t = *top.first;
+                if (top.second)
+                {
+                    _totals[t.id] = combine_children(t);
+                    _known[t.id] = 1;
+                    continue;
+                }
+
+                stack.push_back(std::make_pair(&t, true));
+                for (auto& c : t.children) stack.push_back(std::make_pair(&c, false));
+            }
+        }
+
+        uint32_t largest_id(node const& n) const
+        {
+            auto id = n.id;
+            std::vector<node const*> stack(1, &n);
+
+            while (!stack.empty())
+            {
+                auto top = stack.back();
+                stack.pop_back();
+
+                id = (std::max)(id, top->id);
+                for (auto& c : top->children) stack.push_back(&c);
+            }
+            return id;
+        }
+
+        // Totals of the whole subtree of 'n', bottom-up.  Large subtrees
+        // are split at the first level with a few times as many nodes as
+        // there are threads; those subtrees are computed in parallel and
+        // the levels above them afterwards.
+        void build(node& n, uint32_t id_limit)
+        {
+            reserve(id_limit);
+
+            std::vector<node*> upper;
+            std::vector<node*> frontier(1, &n);
+            auto wanted = _pool.size() * 8;
+
+            while (_pool.size() > 1 && frontier.size() < wanted)
+            {
+                std::vector<node*> next;
+                for (auto f : frontier)
+                    for (auto& c : f->children) next.push_back(&c);
+                if (next.empty()) break;
+
+                upper.insert(upper.end(), frontier.begin(), frontier.end());
+                frontier.swap(next);
+            }
+
+            parallel::for_each_slice(_pool, frontier.size(), 1, [&](size_t begin, size_t end)
+            {
+                for (auto i = begin; i < end; i++) compute(*frontier[i]);
+            });
+
+            for (auto it = upper.rbegin(); it != upper.rend(); ++it)
+            {
+                _totals[(*it)->id] = combine_children(**it);
+                _known[(*it)->id] = 1;
+            }
+        }
+
+        // The total of 'n' went from 'before' to its current value; brings
+        // its ancestors in line.
+        void propagate(node const& n, T const& before)
+        {
+            for (auto a = n.parent; a != nullptr; a = a->parent)
+            {
+                if (!known(*a)) return;
+
+                if (_remove)
+                    _totals[a->id] = _combine(_remove(_totals[a->id], before), _totals[n.id]);
+                else
+                    _totals[a->id] = combine_children(*a);
+            }
+        }
+
+        // Adds the parts to, or takes them out of, the totals of 'parent'
+        // and its ancestors.
+        void adjust(node& parent, T const& added, T const& removed)
+        {
+            for (node* a = &parent; a != nullptr; a = a->parent)
+            {
+                if (!known(*a)) return;
+
+                if (_remove)
+                    _totals[a->id] = _combine(_remove(_totals[a->id], removed), added);
+                else
+                    _totals[a->id] = combine_children(*a);
+            }
+        }
+
+    public:
+        aggregate(own_function own, combine_function combine, T identity,
+            combine_function remove = combine_function(),
+            parallel::thread_pool& pool = parallel::thread_pool::instance())
+            : _own(own), _combine(combine), _remove(remove), _identity(identity), _pool(pool) {}
+
+        // Total of the subtree of 'n', or nullptr if it has not been
+        // computed; by node id, to match the table's column data.
+        T const* find(uint32_t id) const
+        {
+            return id < _known.size() && _known[id] ? &_totals[id] : nullptr;
+        }
+
+        T const& operator[](node const& n) const { return _totals[n.id]; }
+
+        // Computes every total from scratch.
+        void initialize(tree_model& m)
+        {
+            _totals.clear();
+            _known.clear();
+            build(m.root(), m.id_limit());
+        }
+
+        // The own value of 'n' has changed.
+        void changed(node& n)
+        {
+            if (!known(n)) return;
+
+            auto before = _totals[n.id];
+            _totals[n.id] = combine_children(n);
+            propagate(n, before);
+        }
+
+        // Keeps the totals in step with edits to the model.
+        void update(change_list const& changes)
+        {
+            for (auto& c : changes)
+            {
+                switch (c.kind)
+                {
+                case change::insert:
+                {
+                    // Nodes already known were inside a subtree inserted
+                    // earlier in the same batch, and counted with it.
+                    std::vector<node*> added;
+                    uint32_t limit = 0;
+                    for (auto it = c.first;; ++it)
+                    {
+                        if (!known(*it))
+                        {
+                            added.push_back(&*it);
+                            limit = (std::max)(limit, largest_id(*it));
+                        }
+                        if (it == c.last) break;
+                    }
+
+                    auto total = _identity;
+                    for (auto n : added)
+                    {
+                        build(*n, limit);
+                        total = _combine(total, _totals[n->id]);
+                    }
+                    if (!added.empty()) adjust(*c.parent, total, _identity);
+                    break;
+                }
+
+                case change::remove:
+                {
+                    auto total = _identity;
+                    for (auto it = c.first;; ++it)
+                    {
+                        total = _combine(total, _totals[it->id]);
+                        if (it == c.last) break;
+                    }
+                    adjust(*c.parent, _identity, total);
+                    break;
+                }
+
+                case change::move:
+                    adjust(*c.target, _identity, _totals[c.first->id]);
+                    adjust(*c.parent, _totals[c.first->id], _identity);
+                    break;
+
+                case change::rename:
+                    changed(*c.target);
+                    break;
+
+                case change::expand:
+                {
+                    // Expanding may have loaded children the model did not
+                    // report as inserts.
+                    auto& n = *c.target;
+                    if (!n.children.empty() && !known(n.children.front()))
+                    {
+                        auto before = known(n) ? _totals[n.id] : _identity;
+                        build(n, largest_id(n));
+                        propagate(n, before);
+                    }
+                    break;
+                }
+                }
+            }
+        }
+    };
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Test hook for allocation-free code paths.  With GUI_COUNT_ALLOCATIONS
+// defined, the global operator new is replaced by one that counts calls,
+// so a frame can check it did not touch the heap.  Include from exactly one
+// translation unit.
+namespace diagnostics
+{
+    std::atomic<size_t> allocations(0);
+
+    bool counting_allocations()
+    {
+#ifdef GUI_COUNT_ALLOCATIONS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Global heap allocations made while it is alive.
+    class allocation_scope
+    {
+        size_t _start;
+
+    public:
+        allocation_scope() : _start(allocations.load()) {}
+
+        size_t count() const { return allocations.load() - _start; }
+    };
+}
+
+#ifdef GUI_COUNT_ALLOCATIONS
+void* operator new(size_t size)
+{
+    diagnostics::allocations++;
+    if (auto p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+#endif
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace drawing
+{
+    // Scratch memory for the length of one frame.  Allocation bumps a
+    // pointer; reset() at the end of the frame takes it all back at once.
+    // Blocks are kept across frames, so once the arena has grown to what a
+    // frame needs it stops allocating.  Nothing allocated here is destroyed,
+    // so it may only hold trivially destructible data.
+    class frame_arena
+    {
+        struct block
+        {
+            std::unique_ptr<char[]> data;
+            size_t size;
+        };
+
+        std::vector<block> _blocks;
+        size_t _current;
+        size_t _used;
+        size_t _peak;
+        size_t _total;
+
+        frame_arena(frame_arena const&);
+        frame_arena& operator=(frame_arena const&);
+
+    public:
+        frame_arena(size_t initial = 16 * 1024)
+            : _current(0), _used(0), _peak(0), _total(0)
+        {
+            block b = { std::unique_ptr<char[]>(new char[initial]), initial };
+            _blocks.push_back(std::move(b));
+        }
+
+        void* allocate(size_t size, size_t align = alignof(std::max_align_t))
+        {
+            for (;;)
+            {
+                auto& b = _blocks[_current];
+                auto base = (uintptr_t)b.data.get();
+                auto offset = ((base + _used + align - 1) & ~(uintptr_t)(align - 1)) - base;
+
+                if (offset + size <= b.size)
+                {
+                    _used = offset + size;
+                    _total += size;
+                    return b.data.get() + offset;
+                }
+
+                if (++_current == _blocks.size())
+                {
+                    auto grown = (std::max)(b.size * 2, size + align);
+                    block next = { std::unique_ptr<char[]>(new char[grown]), grown };
+                    _blocks.push_back(std::move(next));
+                }
+                _used = 0;
+            }
+        }
+
+        template <typename T>
+        T* allocate_array(size_t count)
+        {
+            static_assert(std::is_trivially_destructible<T>::value,
+                "frame_arena does not run destructors");
+            return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+        }
+
+        // Frees everything allocated since the last reset.
+        void reset()
+        {
+            _peak = (std::max)(_peak, _total);
+            _current = 0;
+            _used = 0;
+            _total = 0;
+        }
+
+        // Bytes handed out this frame, and the most any frame has used.
+        size_t used() const { return _total; }
+        size_t peak() const { return (std::max)(_peak, _total); }
+
+        size_t capacity() const
+        {
+            size_t size = 0;
+            for (auto& b : _blocks) size += b.size;
+            return size;
+        }
+    };
+
+    // Text built up in a frame arena, for labels that change every frame.
+    // Growing copies into a larger allocation from the same arena.
+    class frame_text
+    {
+        frame_arena& _arena;
+        wchar_t* _data;
+        size_t _length;
+        size_t _capacity;
+
+        void reserve(size_t length)
+        {
+            if (length <= _capacity) return;
+
+            auto capacity = (std::max)(length, _capacity * 2);
+            auto data = _arena.allocate_array<wchar_t>(capacity);
+            std::char_traits<wchar_t>::copy(data, _data, _length);
+
+            _data = data;
+            _capacity = capacity;
+        }
+
+    public:
+        frame_text(frame_arena& arena, size_t capacity = 64)
+            : _arena(arena), _data(arena.allocate_array<wchar_t>(capacity)),
+            _length(0), _capacity(capacity) {}
+
+        frame_text& operator<<(std::wstring_view s)
+        {
+            reserve(_length + s.length());
+            std::char_traits<wchar_t>::copy(_data + _length, s.data(), s.length());
+            _length += s.length();
+            return *this;
+        }
+
+        frame_text& operator<<(wchar_t const* s)
+        {
+            return *this << std::wstring_view(s);
+        }
+
+        template <typename T>
+        typename std::enable_if<std::is_integral<T>::value, frame_text&>::type
+            operator<<(T value)
+        {
+            wchar_t digits[24];
+            auto end = digits + 24;
+            auto p = end;
+
+            bool negative = value < 0;
+            auto magnitude = negative ?
+                0 - (unsigned long long)value : (unsigned long long)value;
+
+            do
+            {
+                *--p = (wchar_t)(L'0' + magnitude % 10);
+                magnitude /= 10;
+            } while (magnitude != 0);
+
+            if (negative) *--p = L'-';
+
+            return *this << std::wstring_view(p, end - p);
+        }
+
+        std::wstring_view view() const { return std::wstring_view(_data, _length); }
+        size_t length() const { return _length; }
+    };
+}
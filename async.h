@@ -0,0 +1,202 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <boost/asio/io_service.hpp>
+#include "ui.h"
+#include "profile.h"
+
+namespace ui
+{
+    // Recycles coroutine frames: a freed frame goes on the free list of its
+    // size class and is handed out to the next coroutine of that size, so
+    // once a flow has run a few times it no longer touches the heap.
+    // Frames may be freed on another thread than the one that made them.
+    class frame_pool
+    {
+        struct block
+        {
+            block* next;
+        };
+
+        static const size_t smallest = 64;
+        static const size_t classes = 8;
+
+        block* _free[classes];
+        std::mutex _lock;
+
+        frame_pool()
+        {
+            for (auto& f : _free) f = nullptr;
+        }
+
+        static size_t class_of(size_t size)
+        {
+            size_t c = 0;
+            for (auto s = smallest; s < size; s *= 2) c++;
+            return c;
+        }
+
+    public:
+        static frame_pool& instance()
+        {
+            static frame_pool pool;
+            return pool;
+        }
+
+        void* allocate(size_t size)
+        {
+            auto c = class_of(size);
+            if (c >= classes) return ::operator new(size);
+
+            {
+                std::lock_guard<std::mutex> hold(_lock);
+                if (auto b = _free[c])
+                {
+                    _free[c] = b->next;
+                    return b;
+                }
+            }
+            return ::operator new(smallest << c);
+        }
+
+        void deallocate(void* p, size_t size)
+        {
+            auto c = class_of(size);
+            if (c >= classes)
+            {
+                ::operator delete(p);
+                return;
+            }
+
+            auto b = static_cast<block*>(p);
+            std::lock_guard<std::mutex> hold(_lock);
+            b->next = _free[c];
+            _free[c] = b;
+        }
+    };
+
+    // Return type of a fire-and-forget coroutine.  It starts at once and
+    // frees its frame when it finishes; an exception escaping it terminates
+    // the program, since there is nobody to report it to.
+    struct async
+    {
+        struct promise_type
+        {
+            async get_return_object() { return async(); }
+            std::suspend_never initial_suspend() noexcept { return std::suspend_never(); }
+            std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+
+            static void* operator new(size_t size)
+            {
+                return frame_pool::instance().allocate(size);
+            }
+
+            static void operator delete(void* p, size_t size)
+            {
+                frame_pool::instance().deallocate(p, size);
+            }
+        };
+    };
+
+    // Base of the awaiters that resume through a window: the continuation
+    // lives in the awaiter, which lives in the suspended coroutine's frame.
+    class window_awaiter : protected continuation
+    {
+        static void resume_handle(continuation& c)
+        {
+            static_cast<window_awaiter&>(c)._handle.resume();
+        }
+
+    protected:
+        window& _window;
+        std::coroutine_handle<> _handle;
+
+        window_awaiter(window& w) : _window(w)
+        {
+            next = nullptr;
+            resume = &resume_handle;
+        }
+
+    public:
+        void await_resume() const {}
+    };
+
+    // co_await resume_on_ui(w): continues on w's UI thread.
+    class resume_on_ui : public window_awaiter
+    {
+    public:
+        resume_on_ui(window& w) : window_awaiter(w) {}
+
+        bool await_ready() const { return _window.on_ui_thread(); }
+
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            _handle = h;
+            _window.post(*this);
+        }
+    };
+
+    // co_await next_frame(w): continues on the UI thread once the next
+    // frame of w has been presented, or w has closed.
+    class next_frame : public window_awaiter
+    {
+    public:
+        next_frame(window& w) : window_awaiter(w) {}
+
+        bool await_ready() const { return false; }
+
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            _handle = h;
+            _window.after_frame(*this);
+        }
+    };
+
+    // co_await delay(w, ms): continues on the UI thread after 'ms'
+    // milliseconds, timed by w's message loop, or once w has closed.
+    class delay : public window_awaiter
+    {
+        unsigned _ms;
+
+    public:
+        delay(window& w, unsigned ms) : window_awaiter(w), _ms(ms) {}
+
+        bool await_ready() const { return false; }
+
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            _handle = h;
+            _window.after(*this, _ms);
+        }
+    };
+
+    // co_await resume_on_io(io): continues on a thread running 'io'.  The
+    // posted handler is one pointer, which asio allocates from its recycled
+    // per-thread handler memory.
+    class resume_on_io
+    {
+        boost::asio::io_service& _io;
+
+    public:
+        resume_on_io(boost::asio::io_service& io) : _io(io) {}
+
+        bool await_ready() const { return false; }
+
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            _io.post([h]()
+            {
+                TRACE_ZONE("resume on io");
+                h.resume();
+            });
+        }
+
+        void await_resume() const {}
+    };
+}
@@ -0,0 +1,533 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <ostream>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "geometry.h"
+
+// Text for drawing without Direct2D: glyphs are rasterized once into a
+// shared coverage atlas and labels are drawn as batches of blits from it
+// into a bitmap in memory.  With TEXT_FREETYPE defined, freetype_source
+// supplies glyphs from a font file through FreeType.
+#ifdef TEXT_FREETYPE
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#endif
+
+namespace drawing
+{
+    // Pixels in memory, for drawing without a GPU or a window: 32-bit
+    // premultiplied BGRA, rows top to bottom.
+    struct bitmap
+    {
+        int width;
+        int height;
+        std::vector<uint32_t> pixels;
+
+        bitmap(int w, int h) : width(w), height(h), pixels((size_t)w * h, 0) {}
+
+        uint32_t* row(int y) { return pixels.data() + (size_t)y * width; }
+        uint32_t const* row(int y) const { return pixels.data() + (size_t)y * width; }
+    };
+}
+
+namespace text
+{
+    class font_exception : public std::exception
+    {
+        char const* _reason;
+
+    public:
+        font_exception(char const* reason) : _reason(reason) {}
+
+        char const* what() const noexcept override { return _reason; }
+    };
+
+    // Coverage of one glyph, a byte per pixel, placed relative to the pen
+    // position on the baseline.
+    struct glyph_image
+    {
+        int left;    // from the pen to the first column
+        int top;     // from the baseline up to the first row
+        int width;
+        int height;
+        std::vector<uint8_t> coverage;
+    };
+
+    // One font face at one size, as the atlas sees it.  Each source has an
+    // id of its own, so glyphs of several faces and sizes can share an
+    // atlas.  Characters map to glyphs one code unit at a time: there is
+    // no shaping, bidi or fallback on this path.
+    class glyph_source
+    {
+        struct mapped
+        {
+            uint16_t glyph;
+            float advance;
+        };
+
+        uint32_t _id;
+        std::unordered_map<uint32_t, mapped> _mapped;
+
+        glyph_source(glyph_source const&);
+        glyph_source& operator=(glyph_source const&);
+
+        static uint32_t next_id()
+        {
+            static std::atomic<uint32_t> ids(1);
+            return ids++;
+        }
+
+    protected:
+        // Glyph of 'c' and its advance; glyph 0 if the face lacks it.
+        virtual void lookup(uint32_t c, uint16_t& glyph, float& advance) = 0;
+
+    public:
+        glyph_source() : _id(next_id()) {}
+        virtual ~glyph_source() {}
+
+        uint32_t id() const { return _id; }
+
+        virtual float ascent() const = 0;
+        virtual float line_height() const = 0;
+
+        // Renders 'glyph' with the pen 'offset' (0 to 1) of a pixel right
+        // of a pixel boundary.
+        virtual void rasterize(uint16_t glyph, float offset, glyph_image& out) = 0;
+
+        // Cached per character after the first lookup.
+        uint16_t glyph(uint32_t c, float& advance)
+        {
+            auto found = _mapped.find(c);
+            if (found == _mapped.end())
+            {
+                mapped m;
+                lookup(c, m.glyph, m.advance);
+                found = _mapped.emplace(c, m).first;
+            }
+            advance = found->second.advance;
+            return found->second.glyph;
+        }
+    };
+
+#ifdef TEXT_FREETYPE
+    // Glyphs of a font file rendered by FreeType, unhinted and
+    // antialiased.  'size' is the em size in pixels.
+    class freetype_source : public glyph_source
+    {
+        FT_Library _library;
+        FT_Face _face;
+        float _ascent;
+        float _height;
+
+    protected:
+        void lookup(uint32_t c, uint16_t& glyph, float& advance) override
+        {
+            glyph = (uint16_t)FT_Get_Char_Index(_face, c);
+            advance = 0;
+            if (glyph != 0 && FT_Load_Glyph(_face, glyph, FT_LOAD_NO_HINTING) == 0)
+                advance = _face->glyph->linearHoriAdvance / 65536.0f;
+        }
+
+    public:
+        freetype_source(char const* path, float size)
+            : _library(nullptr), _face(nullptr)
+        {
+            if (FT_Init_FreeType(&_library) != 0)
+                throw font_exception("FreeType did not start");
+
+            if (FT_New_Face(_library, path, 0, &_face) != 0)
+            {
+                FT_Done_FreeType(_library);
+                throw font_exception("cannot open font");
+            }
+
+            FT_Set_Char_Size(_face, 0, (FT_F26Dot6)(size * 64), 72, 72);
+
+            auto scale = size / _face->units_per_EM;
+            _ascent = _face->ascender * scale;
+            _height = _face->height * scale;
+        }
+
+        ~freetype_source()
+        {
+            FT_Done_Face(_face);
+            FT_Done_FreeType(_library);
+        }
+
+        float ascent() const override { return _ascent; }
+        float line_height() const override { return _height; }
+
+        void rasterize(uint16_t glyph, float offset, glyph_image& out) override
+        {
+            FT_Vector shift = { (FT_Pos)(offset * 64), 0 };
+            FT_Set_Transform(_face, nullptr, &shift);
+
+            out.left = out.top = out.width = out.height = 0;
+            out.coverage.clear();
+            if (FT_Load_Glyph(_face, glyph, FT_LOAD_RENDER | FT_LOAD_NO_HINTING) != 0)
+                return;
+
+            auto slot = _face->glyph;
+            auto& b = slot->bitmap;
+            if (b.pixel_mode != FT_PIXEL_MODE_GRAY) return;
+
+            out.left = slot->bitmap_left;
+            out.top = slot->bitmap_top;
+            out.width = (int)b.width;
+            out.height = (int)b.rows;
+            out.coverage.resize((size_t)out.width * out.height);
+            for (int y = 0; y < out.height; y++)
+                std::copy(b.buffer + y * b.pitch, b.buffer + y * b.pitch + out.width,
+                    out.coverage.begin() + (size_t)y * out.width);
+        }
+    };
+#endif
+
+    // Rasterized glyphs packed into one square coverage texture.  A glyph
+    // is rasterized once per source and quarter-pixel pen offset; shelves
+    // are filled left to right and top to bottom, and a full atlas is
+    // cleared and filled again rather than compacted.
+    class glyph_atlas
+    {
+    public:
+        static const int subpixel_steps = 4;
+
+        struct entry
+        {
+            uint16_t x;
+            uint16_t y;
+            uint16_t width;
+            uint16_t height;
+            int16_t left;
+            int16_t top;
+        };
+
+        struct statistics
+        {
+            uint64_t lookups;
+            uint64_t hits;
+            uint64_t rasterized;
+            uint32_t resets;
+
+            double hit_rate() const { return lookups ? (double)hits / lookups : 1; }
+        };
+
+    private:
+        int _size;
+        std::vector<uint8_t> _pixels;
+
+        int _shelf_x;
+        int _shelf_y;
+        int _shelf_height;
+
+        std::unordered_map<uint64_t, entry> _entries;
+        glyph_image _scratch;
+        statistics _stats;
+        uint32_t _generation;
+
+        glyph_atlas(glyph_atlas const&);
+        glyph_atlas& operator=(glyph_atlas const&);
+
+        void reset()
+        {
+            _entries.clear();
+            std::fill(_pixels.begin(), _pixels.end(), (uint8_t)0);
+            _shelf_x = _shelf_y = _shelf_height = 0;
+            _stats.resets++;
+            _generation++;
+        }
+
+        // Room for a width x height box with a pixel of padding, or false.
+        bool place(int width, int height, int& x, int& y)
+        {
+            width++;
+            height++;
+            if (width > _size || height > _size) return false;
+
+            if (_shelf_x + width > _size)
+            {
+                _shelf_y += _shelf_height;
+                _shelf_x = _shelf_height = 0;
+            }
+            if (_shelf_y + height > _size) return false;
+
+            x = _shelf_x;
+            y = _shelf_y;
+            _shelf_x += width;
+            _shelf_height = (std::max)(_shelf_height, height);
+            return true;
+        }
+
+    public:
+        glyph_atlas(int size = 1024)
+            : _size(size), _pixels((size_t)size * size, 0),
+            _shelf_x(0), _shelf_y(0), _shelf_height(0), _generation(0)
+        {
+            _stats.lookups = _stats.hits = _stats.rasterized = 0;
+            _stats.resets = 0;
+        }
+
+        int size() const { return _size; }
+        uint8_t const* row(int y) const { return _pixels.data() + (size_t)y * _size; }
+
+        // Changes whenever the atlas is cleared, which moves every glyph.
+        uint32_t generation() const { return _generation; }
+
+        statistics const& stats() const { return _stats; }
+
+        // Where 'glyph' of 's' with its pen 'step' quarter pixels right of
+        // a pixel boundary is, rasterizing it first if need be.  Glyphs too
+        // large for the atlas come back empty.
+        entry find(glyph_source& s, uint16_t glyph, int step)
+        {
+            _stats.lookups++;
+
+            auto key = (uint64_t)s.id() << 24 | (uint64_t)glyph << 8 | (uint64_t)step;
+            auto found = _entries.find(key);
+            if (found != _entries.end())
+            {
+                _stats.hits++;
+                return found->second;
+            }
+
+            s.rasterize(glyph, (float)step / subpixel_steps, _scratch);
+            _stats.rasterized++;
+
+            // Glyphs that would not fit even in an empty atlas are kept
+            // empty rather than clearing it for nothing.
+            entry e = { 0, 0, 0, 0, (int16_t)_scratch.left, (int16_t)_scratch.top };
+            int x, y;
+            if (_scratch.width > 0 && _scratch.height > 0 &&
+                _scratch.width < _size && _scratch.height < _size)
+            {
+                if (!place(_scratch.width, _scratch.height, x, y))
+                {
+                    reset();
+                    place(_scratch.width, _scratch.height, x, y);
+                }
+
+                for (int r = 0; r < _scratch.height; r++)
+                    std::copy(_scratch.coverage.begin() + (size_t)r * _scratch.width,
+                        _scratch.coverage.begin() + (size_t)(r + 1) * _scratch.width,
+                        _pixels.begin() + (size_t)(y + r) * _size + x);
+
+                e.x = (uint16_t)x;
+                e.y = (uint16_t)y;
+                e.width = (uint16_t)_scratch.width;
+                e.height = (uint16_t)_scratch.height;
+            }
+
+            _entries.emplace(key, e);
+            return e;
+        }
+    };
+
+    // Labels drawn into a bitmap from a glyph atlas, the headless
+    // counterpart of write_label with a glyph_cache: the same trimming
+    // with an ellipsis, then one batch of blits per label.
+    class atlas_text
+    {
+        struct quad
+        {
+            glyph_atlas::entry glyph;
+            int x;
+            int y;
+        };
+
+        glyph_source& _source;
+        glyph_atlas& _atlas;
+
+        std::vector<uint16_t> _glyphs;
+        std::vector<float> _advances;
+        std::vector<quad> _quads;
+
+        uint16_t _ellipsis;
+        float _ellipsis_advance;
+
+        uint64_t _drawn;
+        uint64_t _dropped;
+        std::chrono::steady_clock::duration _spent;
+
+        // Glyphs of 's' that fit in 'max_width', with an ellipsis if
+        // trimmed.
+        void fit(std::wstring_view s, drawing::distance max_width)
+        {
+            _glyphs.clear();
+            _advances.clear();
+
+            float width = 0;
+            for (auto c : s)
+            {
+                float advance;
+                auto g = _source.glyph((uint32_t)c, advance);
+                _glyphs.push_back(g);
+                _advances.push_back(advance);
+                width += advance;
+            }
+            if (width <= max_width) return;
+
+            size_t count = 0;
+            width = 0;
+            if (max_width >= _ellipsis_advance)
+                for (; count < _glyphs.size() &&
+                    width + _advances[count] <= max_width - _ellipsis_advance; count++)
+                    width += _advances[count];
+
+            _glyphs.resize(count);
+            _advances.resize(count);
+            if (max_width >= _ellipsis_advance)
+            {
+                _glyphs.push_back(_ellipsis);
+                _advances.push_back(_ellipsis_advance);
+            }
+        }
+
+        // Quads of the fitted glyphs with the pen starting at 'origin' on
+        // the baseline.  Stops, with no quads, as soon as the atlas is
+        // cleared, since that moved the glyphs placed before.
+        bool place(drawing::point const& origin)
+        {
+            _quads.clear();
+            auto generation = _atlas.generation();
+
+            float pen = origin.x;
+            int baseline = (int)std::floor(origin.y + 0.5f);
+            for (size_t i = 0; i < _glyphs.size(); i++)
+            {
+                auto whole = std::floor(pen);
+                auto step = (int)((pen - whole) * glyph_atlas::subpixel_steps);
+                auto e = _atlas.find(_source, _glyphs[i], step);
+                if (_atlas.generation() != generation)
+                {
+                    _quads.clear();
+                    return false;
+                }
+
+                if (e.width > 0)
+                {
+                    quad q = { e, (int)whole + e.left, baseline - e.top };
+                    _quads.push_back(q);
+                }
+                pen += _advances[i];
+            }
+            return true;
+        }
+
+        // Blends the quads over 't' in 'c', clipped to 'clip'.
+        void blit(drawing::bitmap& t, drawing::rectangle const& clip, drawing::color const& c)
+        {
+            int left = (std::max)(0, (int)std::ceil(clip.left));
+            int top = (std::max)(0, (int)std::ceil(clip.top));
+            int right = (std::min)(t.width, (int)std::floor(clip.right));
+            int bottom = (std::min)(t.height, (int)std::floor(clip.bottom));
+
+            // Premultiplied colour, channels scaled to 0..255.
+            uint32_t a = (uint32_t)(c.a * 255 + 0.5f);
+            uint32_t r = (uint32_t)(c.r * c.a * 255 + 0.5f);
+            uint32_t g = (uint32_t)(c.g * c.a * 255 + 0.5f);
+            uint32_t b = (uint32_t)(c.b * c.a * 255 + 0.5f);
+
+            for (auto& q : _quads)
+            {
+                int x0 = (std::max)(left, q.x);
+                int y0 = (std::max)(top, q.y);
+                int x1 = (std::min)(right, q.x + q.glyph.width);
+                int y1 = (std::min)(bottom, q.y + q.glyph.height);
+
+                for (int y = y0; y < y1; y++)
+                {
+                    auto src = _atlas.row(q.glyph.y + y - q.y) + q.glyph.x;
+                    auto dst = t.row(y);
+                    for (int x = x0; x < x1; x++)
+                    {
+                        uint32_t cover = src[x - q.x];
+                        if (cover == 0) continue;
+
+                        auto p = dst[x];
+                        auto keep = 255 * 255 - cover * a;
+                        auto blend = [&](uint32_t from, int shift)
+                        {
+                            return ((from * cover * 255 + ((p >> shift) & 0xff) * keep) / (255 * 255)) << shift;
+                        };
+                        dst[x] = blend(b, 0) | blend(g, 8) | blend(r, 16) | blend(a, 24);
+                    }
+                }
+            }
+        }
+
+    public:
+        // Drawn in this colour; black to start with.
+        drawing::color color;
+
+        atlas_text(glyph_source& source, glyph_atlas& atlas)
+            : _source(source), _atlas(atlas), _drawn(0), _dropped(0),
+            _spent(std::chrono::steady_clock::duration::zero())
+        {
+            _ellipsis = _source.glyph(0x2026, _ellipsis_advance);
+            color.r = color.g = color.b = 0;
+            color.a = 1;
+        }
+
+        // Writes 's' on one line at the top left of 'r', trimmed to its
+        // width and clipped to it.  Returns false, drawing nothing, if its
+        // glyphs do not all fit in the atlas at once.
+        bool write_label(drawing::bitmap& t, std::wstring_view s, drawing::rectangle const& r)
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            fit(s, r.width());
+            drawing::point origin(r.left, r.top + _source.ascent());
+
+            // A clear in the middle of the label moved the glyphs placed
+            // before it, so it is placed again in the emptied atlas.  If
+            // that fills up too, the label needs more than the atlas holds.
+            bool placed = place(origin) || place(origin);
+            if (placed)
+            {
+                blit(t, r, color);
+                _drawn += _glyphs.size();
+            }
+            else
+            {
+                _dropped++;
+            }
+
+            _spent += std::chrono::steady_clock::now() - start;
+            return placed;
+        }
+
+        uint64_t glyphs_drawn() const { return _drawn; }
+
+        // Labels not drawn because the atlas could not hold them.
+        uint64_t labels_dropped() const { return _dropped; }
+
+        double glyphs_per_second() const
+        {
+            auto seconds = std::chrono::duration<double>(_spent).count();
+            return seconds > 0 ? _drawn / seconds : 0;
+        }
+
+        // Throughput of the labels written so far and how often the atlas
+        // already held their glyphs.
+        void write_statistics(std::ostream& out) const
+        {
+            auto& s = _atlas.stats();
+            char line[192];
+            snprintf(line, sizeof(line),
+                "%llu glyphs, %.0f glyphs/s, atlas hit rate %.2f%% (%llu rasterized, %u resets), "
+                "%llu labels dropped\n",
+                (unsigned long long)_drawn, glyphs_per_second(), 100 * s.hit_rate(),
+                (unsigned long long)s.rasterized, s.resets, (unsigned long long)_dropped);
+            out << line;
+        }
+    };
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+
+namespace ui
+{
+    // Time as animations, scrolling and idle work see it.  It follows
+    // steady_clock, except while a replay holds it at the recorded time of
+    // the event being replayed, so every run of a trace sees the same
+    // timeline.  Each read of a held clock moves it on by a microsecond, so
+    // loops waiting for time to pass, like idle slices, still end, after the
+    // same number of reads every time.
+    class frame_clock
+    {
+    public:
+        typedef std::chrono::steady_clock::duration duration;
+        typedef duration::rep rep;
+        typedef duration::period period;
+        typedef std::chrono::time_point<frame_clock> time_point;
+        static const bool is_steady = true;
+
+        static time_point now()
+        {
+            auto& held = held_at();
+            auto t = held.load();
+            if (t == free)
+                return time_point(steady_now() + duration(ahead().load()));
+
+            const rep step = std::chrono::duration_cast<duration>(
+                std::chrono::microseconds(1)).count();
+            return time_point(duration(held.fetch_add(step)));
+        }
+
+        // Stops the clock at 't', or moves a held clock there.
+        static void hold(time_point t)
+        {
+            held_at() = t.time_since_epoch().count();
+        }
+
+        // Lets the clock run again.  It never goes back: if it was held
+        // ahead of steady_clock, it stays that far ahead.
+        static void release()
+        {
+            auto t = held_at().exchange(free);
+            if (t != free)
+                ahead() = (std::max)(rep(0), t - steady_now().count());
+        }
+
+        static bool held()
+        {
+            return held_at().load() != free;
+        }
+
+    private:
+        static const rep free = (std::numeric_limits<rep>::min)();
+
+        static duration steady_now()
+        {
+            return std::chrono::steady_clock::now().time_since_epoch();
+        }
+
+        static std::atomic<rep>& held_at()
+        {
+            static std::atomic<rep> t(free);
+            return t;
+        }
+
+        static std::atomic<rep>& ahead()
+        {
+            static std::atomic<rep> d(0);
+            return d;
+        }
+    };
+}
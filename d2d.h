@@ -1,8 +1,12 @@
 #pragma once
 
 #include <d2d1.h>
+#include <algorithm>
 #include <exception>
+#include <vector>
 #include "geometry.h"
+#include "arena.h"
+#include "profile.h"
 
 #pragma comment(lib, "d2d1")
 
@@ -37,6 +41,7 @@ namespace drawing
             T** operator&() { return &ptr; }
             operator T*() { return ptr; }
             T*& get() { return ptr; }
+            T* get() const { return ptr; }
             T* operator->() { return ptr; }
         };
 
@@ -65,9 +70,230 @@ namespace drawing
 
     namespace d2d
     {
+        // Rectangles and lines drawn, and the runs they were drawn in, on
+        // the calling thread since the last reset.
+        struct batch_statistics
+        {
+            size_t primitives;
+            size_t submissions;
+
+            size_t saved() const { return primitives - submissions; }
+
+            static batch_statistics& current()
+            {
+                thread_local batch_statistics statistics = { 0, 0 };
+                return statistics;
+            }
+        };
+
+        // Solid rectangles and lines waiting to be drawn together.  A run of
+        // fills, or of strokes, in one colour is drawn with one brush, each
+        // primitive through Direct2D's rectangle and line calls, which it
+        // batches itself.  With GUI_MERGE_PATHS defined, a run of several
+        // primitives in an opaque colour becomes a single path geometry
+        // instead, kept until a run differs; compare "/replay" frame times
+        // of both builds before turning it on.  Any other primitive, and
+        // anything else done to the target, must flush first so drawing
+        // order holds; clips and transforms therefore never change under a
+        // run.  Translucent primitives are not merged, since overlaps
+        // within one geometry would be blended only once.
+        class primitive_batch
+        {
+            enum kind { none, fills, strokes };
+
+            kind _kind;
+            color _color;
+            std::vector<rectangle> _rectangles;
+            std::vector<line> _lines;
+
+#ifdef GUI_MERGE_PATHS
+            // The last merged run, and its geometry.
+            kind _path_kind;
+            std::vector<rectangle> _path_rectangles;
+            std::vector<line> _path_lines;
+            scoped_resource<ID2D1PathGeometry> _path;
+#endif
+
+            primitive_batch(primitive_batch const&);
+            primitive_batch& operator=(primitive_batch const&);
+
+            void begin(ID2D1RenderTarget* native, kind k, color const& c)
+            {
+                if (_kind != k ||
+                    _color.r != c.r || _color.g != c.g ||
+                    _color.b != c.b || _color.a != c.a
+#ifdef GUI_MERGE_PATHS
+                    || c.a < 1.0f
+#endif
+                    )
+                {
+                    flush(native);
+                }
+
+                _kind = k;
+                _color = c;
+                batch_statistics::current().primitives++;
+            }
+
+            void submit_each(ID2D1RenderTarget* native, ID2D1Brush* brush)
+            {
+                for (auto& r : _rectangles)
+                {
+                    if (_kind == fills)
+                        native->FillRectangle(r, brush);
+                    else
+                        native->DrawRectangle(r, brush);
+                }
+
+                for (auto& l : _lines)
+                    native->DrawLine(l.p1, l.p2, brush);
+            }
+
+#ifdef GUI_MERGE_PATHS
+            // Whether the pending run is the one the cached geometry holds.
+            bool cached() const
+            {
+                auto same_rectangle = [](rectangle const& a, rectangle const& b)
+                {
+                    return a.left == b.left && a.top == b.top &&
+                        a.right == b.right && a.bottom == b.bottom;
+                };
+                auto same_line = [](line const& a, line const& b)
+                {
+                    return a.p1.x == b.p1.x && a.p1.y == b.p1.y &&
+                        a.p2.x == b.p2.x && a.p2.y == b.p2.y;
+                };
+
+                return _path.get() != nullptr && _path_kind == _kind &&
+                    std::equal(_rectangles.begin(), _rectangles.end(),
+                        _path_rectangles.begin(), _path_rectangles.end(), same_rectangle) &&
+                    std::equal(_lines.begin(), _lines.end(),
+                        _path_lines.begin(), _path_lines.end(), same_line);
+            }
+
+            void submit_path(ID2D1RenderTarget* native, ID2D1Brush* brush)
+            {
+                if (!cached())
+                {
+                    _path.release();
+
+                    scoped_resource<ID2D1Factory> factory;
+                    native->GetFactory(&factory);
+                    throw_call(factory->CreatePathGeometry(&_path));
+
+                    scoped_resource<ID2D1GeometrySink> sink;
+                    throw_call(_path->Open(&sink));
+                    sink->SetFillMode(D2D1_FILL_MODE_WINDING);
+
+                    auto begin = _kind == fills
+                        ? D2D1_FIGURE_BEGIN_FILLED
+                        : D2D1_FIGURE_BEGIN_HOLLOW;
+
+                    for (auto& r : _rectangles)
+                    {
+                        sink->BeginFigure(r.top_left(), begin);
+                        sink->AddLine(r.top_right());
+                        sink->AddLine(r.bottom_right());
+                        sink->AddLine(r.bottom_left());
+                        sink->EndFigure(D2D1_FIGURE_END_CLOSED);
+                    }
+
+                    for (auto& l : _lines)
+                    {
+                        sink->BeginFigure(l.p1, begin);
+                        sink->AddLine(l.p2);
+                        sink->EndFigure(D2D1_FIGURE_END_OPEN);
+                    }
+
+                    throw_call(sink->Close());
+
+                    // The run is kept as the key of the geometry; flush
+                    // clears what it is swapped for.
+                    _path_kind = _kind;
+                    _path_rectangles.swap(_rectangles);
+                    _path_lines.swap(_lines);
+                }
+
+                if (_path_kind == fills)
+                    native->FillGeometry(_path, brush);
+                else
+                    native->DrawGeometry(_path, brush, 1.0f);
+            }
+#endif
+
+        public:
+            primitive_batch() : _kind(none), _color()
+#ifdef GUI_MERGE_PATHS
+                , _path_kind(none)
+#endif
+            {
+            }
+
+            void fill(ID2D1RenderTarget* native, rectangle const& r, color const& c)
+            {
+                begin(native, fills, c);
+                _rectangles.push_back(r);
+            }
+
+            void draw(ID2D1RenderTarget* native, rectangle const& r, color const& c)
+            {
+                begin(native, strokes, c);
+                _rectangles.push_back(r);
+            }
+
+            void draw(ID2D1RenderTarget* native, line const& l, color const& c)
+            {
+                begin(native, strokes, c);
+                _lines.push_back(l);
+            }
+
+            // Draws whatever is pending onto 'native'.
+            void flush(ID2D1RenderTarget* native)
+            {
+                auto count = _rectangles.size() + _lines.size();
+                if (count == 0) return;
+
+                scoped_resource<ID2D1SolidColorBrush> brush;
+                throw_call(native->CreateSolidColorBrush(_color, &brush));
+
+#ifdef GUI_MERGE_PATHS
+                if (count > 1)
+                    submit_path(native, brush);
+                else
+                    submit_each(native, brush);
+#else
+                submit_each(native, brush);
+#endif
+
+                batch_statistics::current().submissions++;
+                _rectangles.clear();
+                _lines.clear();
+                _kind = none;
+            }
+        };
+
         struct render_target
         {
+            primitive_batch batch;
+
             virtual ID2D1RenderTarget* get_target() = 0;
+
+            // The device target with pending primitives drawn; use this for
+            // anything not going through the batch.
+            ID2D1RenderTarget* flushed_target()
+            {
+                auto native = get_target();
+                batch.flush(native);
+                return native;
+            }
+
+            // Changes whenever the device target is recreated, so resources
+            // created from it know to follow.
+            virtual unsigned generation() const { return 0; }
+
+            // Scratch memory that lasts until the current frame ends, if the
+            // target draws frames.
+            virtual frame_arena* arena() { return nullptr; }
         };
 
         class hwnd_render_target : public render_target
@@ -75,8 +301,17 @@ namespace drawing
             scoped_resource<ID2D1HwndRenderTarget> _resource;
             ID2D1Factory* _factory;
             HWND _hWnd;
+            unsigned _generation;
+            frame_arena _arena;
+            batch_statistics _batching;
+
+            // Copy of the last frame kept by end_draw(true), shown stretched
+            // when a new size comes in faster than frames can be drawn.
+            scoped_resource<ID2D1Bitmap> _kept;
 
             ID2D1RenderTarget* get_target() override { return _resource.get(); }
+            unsigned generation() const override { return _generation; }
+            frame_arena* arena() override { return &_arena; }
 
             void create()
             {
@@ -95,14 +330,44 @@ namespace drawing
                             D2D1_ALPHA_MODE_PREMULTIPLIED)),
                     D2D1::HwndRenderTargetProperties(_hWnd, size),
                     &_resource));
+
+                _generation++;
             }
 
             void release()
             {
+                _kept.release();
                 _resource.release();
             }
 
+            void keep_frame()
+            {
+                auto target = _resource.get();
+                auto size = target->GetPixelSize();
+
+                if (_kept.get() != nullptr)
+                {
+                    auto kept = _kept.get()->GetPixelSize();
+                    if (kept.width != size.width || kept.height != size.height)
+                        _kept.release();
+                }
+
+                if (_kept.get() == nullptr)
+                {
+                    FLOAT dpi_x, dpi_y;
+                    target->GetDpi(&dpi_x, &dpi_y);
+                    throw_call(target->CreateBitmap(size, nullptr, 0,
+                        D2D1::BitmapProperties(target->GetPixelFormat(), dpi_x, dpi_y),
+                        &_kept));
+                }
+
+                throw_call(_kept->CopyFromRenderTarget(nullptr, target, nullptr));
+            }
+
         public:
+            hwnd_render_target()
+                : _factory(nullptr), _hWnd(NULL), _generation(0), _batching() {}
+
             void bind_hwnd(ID2D1Factory* factory, HWND hWnd)
             {
                 _factory = factory;
@@ -113,6 +378,10 @@ namespace drawing
 
             void begin_draw()
             {
+                TRACE_ZONE("begin_draw");
+
+                batch_statistics::current() = batch_statistics();
+
                 if (!_resource)
                 {
                     create();
@@ -120,13 +389,76 @@ namespace drawing
                 _resource.get()->BeginDraw();
             }
 
-            void end_draw()
+            // With 'keep' set, the frame is also copied for later
+            // present_stretched() calls.
+            void end_draw(bool keep = false)
             {
-                auto hr = _resource.get()->EndDraw();
+                TRACE_ZONE("end_draw");
+
+                auto target = flushed_target();
+                if (keep) keep_frame();
+                else _kept.release();
+
+                auto hr = target->EndDraw();
+                _batching = batch_statistics::current();
                 if (hr == D2DERR_RECREATE_TARGET)
                 {
-                    _resource.release();
+                    release();
+                }
+
+                _arena.reset();
+            }
+
+            // Presents the kept frame scaled to the current size.  Returns
+            // false, drawing nothing, if no frame was kept.
+            bool present_stretched()
+            {
+                TRACE_ZONE("present_stretched");
+
+                if (!_resource || _kept.get() == nullptr) return false;
+
+                auto target = _resource.get();
+                auto size = target->GetSize();
+
+                target->BeginDraw();
+                target->SetTransform(D2D1::Matrix3x2F::Identity());
+                target->DrawBitmap(_kept, D2D1::RectF(0, 0, size.width, size.height),
+                    1.0f, D2D1_BITMAP_INTERPOLATION_MODE_LINEAR);
+
+                if (target->EndDraw() == D2DERR_RECREATE_TARGET)
+                {
+                    release();
+                    return false;
+                }
+                return true;
+            }
+
+            // Frees the kept frame.
+            void drop_frame()
+            {
+                _kept.release();
+            }
+
+            // How much batching saved over the last frame, layers included.
+            batch_statistics const& batching() const { return _batching; }
+
+            // Bytes of the swap chain behind the target, front and back
+            // buffer at four bytes per pixel, of any kept frame, and of the
+            // frame arena.
+            size_t memory() const
+            {
+                size_t buffers = 0;
+                if (_resource.get() != nullptr)
+                {
+                    auto size = _resource.get()->GetPixelSize();
+                    buffers = 2 * 4 * (size_t)size.width * (size_t)size.height;
+                }
+                if (_kept.get() != nullptr)
+                {
+                    auto size = _kept.get()->GetPixelSize();
+                    buffers += 4 * (size_t)size.width * (size_t)size.height;
                 }
+                return buffers + _arena.capacity();
             }
 
             void resize(UINT width, UINT height)
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include "clock.h"
+#include "geometry.h"
+
+namespace ui
+{
+    // When a view may paint placeholders instead of its content.  Speeds
+    // are in device independent pixels per second.
+    struct detail_policy
+    {
+        bool enabled;
+
+        // Scrolling or resizing faster than these drops to coarse detail.
+        float scroll_speed;
+        float resize_speed;
+
+        // Full detail comes back once motion has stayed below both speeds
+        // for this long.
+        std::chrono::milliseconds settle;
+
+        detail_policy()
+            : enabled(true), scroll_speed(2000), resize_speed(1500), settle(150) {}
+    };
+
+    enum detail_level { full_detail, coarse_detail };
+
+    // Picks the level of detail of each frame of a view from how fast its
+    // scroll offset and viewport size change, and keeps the average frame
+    // time at each level so the saving can be shown.
+    class detail_tracker
+    {
+        typedef frame_clock clock;
+
+        detail_policy _policy;
+        detail_level _level;
+
+        bool _measured;
+        clock::time_point _last;
+        clock::time_point _moved;
+        drawing::distance _offset;
+        drawing::distance _width;
+        drawing::distance _height;
+
+        // Moving averages, in milliseconds, per level.
+        float _frame_ms[2];
+
+    public:
+        detail_tracker()
+            : _level(full_detail), _measured(false),
+            _offset(0), _width(0), _height(0)
+        {
+            _frame_ms[full_detail] = _frame_ms[coarse_detail] = 0;
+        }
+
+        detail_policy const& policy() const { return _policy; }
+        void set_policy(detail_policy const& p) { _policy = p; }
+
+        detail_level level() const { return _level; }
+
+        // Call before painting each frame.  Returns the level to paint at.
+        detail_level update(drawing::distance offset,
+            drawing::distance width, drawing::distance height)
+        {
+            auto now = clock::now();
+
+            if (_measured)
+            {
+                std::chrono::duration<float> elapsed = now - _last;
+                if (elapsed.count() > 0)
+                {
+                    auto scrolled = std::fabs(offset - _offset) / elapsed.count();
+                    auto resized = (std::max)(std::fabs(width - _width),
+                        std::fabs(height - _height)) / elapsed.count();
+
+                    if (scrolled > _policy.scroll_speed || resized > _policy.resize_speed)
+                        _moved = now;
+                }
+            }
+
+            _level = _policy.enabled && _measured && now - _moved < _policy.settle
+                ? coarse_detail : full_detail;
+
+            _measured = true;
+            _last = now;
+            _offset = offset;
+            _width = width;
+            _height = height;
+            return _level;
+        }
+
+        // Forgets recent motion, so the next frame is drawn in full detail;
+        // for when the motion is known to have ended, as at the end of an
+        // interactive resize.
+        void settle()
+        {
+            _moved = clock::time_point();
+            _measured = false;
+        }
+
+        // Time left until full detail returns if nothing moves meanwhile.
+        std::chrono::milliseconds until_settled() const
+        {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                _moved + _policy.settle - clock::now());
+            return (std::max)(left, std::chrono::milliseconds(0));
+        }
+
+        // Adds the time taken to paint a frame at the current level.
+        void frame_time(clock::duration took)
+        {
+            std::chrono::duration<float, std::milli> ms = took;
+            auto& average = _frame_ms[_level];
+            average = average == 0 ? ms.count() : average + (ms.count() - average) / 8;
+        }
+
+        float frame_ms(detail_level l) const { return _frame_ms[l]; }
+    };
+}
@@ -7,25 +7,22 @@
 
 namespace drawing
 {
+    // Rectangles and lines are batched per target: consecutive ones of the
+    // same kind and colour reach the device as one geometry when something
+    // else is drawn or the frame ends.
     void draw(target& t, const rectangle& r, const color& c)
     {
-        auto native = t.rtarget->get_target();
-        solid_brush b(native, c);
-        native->DrawRectangle(r, b);
+        t.rtarget->batch.draw(t.rtarget->get_target(), r, c);
     }
 
     void draw(target& t, line const& l, color const& c)
     {
-        auto native = t.rtarget->get_target();
-        solid_brush b(native, c);
-        native->DrawLine(l.p1, l.p2, b);
+        t.rtarget->batch.draw(t.rtarget->get_target(), l, c);
     }
 
     void fill(target& t, const rectangle& r, const color& c)
     {
-        auto native = t.rtarget->get_target();
-        solid_brush b(native, c);
-        native->FillRectangle(r, b);
+        t.rtarget->batch.fill(t.rtarget->get_target(), r, c);
     }
 
     void fill(target& t, const color& c)
@@ -35,22 +32,43 @@ namespace drawing
 
     void write(target& t, point const& p, text::layout const& l, const color& c)
     {
-        auto native = t.rtarget->get_target();
+        auto native = t.rtarget->flushed_target();
         solid_brush b(native, c);
         native->DrawTextLayout(p, const_cast<IDWriteTextLayout*>(l.ptr.get()), b, D2D1_DRAW_TEXT_OPTIONS_CLIP);
     }
 
+    // Draws a run shaped by 'g' with its top-left corner at 'p'.
+    void write(target& t, point const& p, text::glyph_cache const& g, text::glyph_run const& run, color const& c)
+    {
+        if (run.indices.empty()) return;
+
+        auto native = t.rtarget->flushed_target();
+        solid_brush b(native, c);
+
+        DWRITE_GLYPH_RUN glyphs;
+        glyphs.fontFace = g.face();
+        glyphs.fontEmSize = g.size();
+        glyphs.glyphCount = (UINT32)run.indices.size();
+        glyphs.glyphIndices = run.indices.data();
+        glyphs.glyphAdvances = run.advances.data();
+        glyphs.glyphOffsets = nullptr;
+        glyphs.isSideways = FALSE;
+        glyphs.bidiLevel = 0;
+
+        native->DrawGlyphRun(point(p.x, p.y + g.ascent()), &glyphs, b);
+    }
+
     struct clip : target
     {
         clip(target const& t) : target(t)
         {
-            rtarget->get_target()->PushAxisAlignedClip(
+            rtarget->flushed_target()->PushAxisAlignedClip(
                 t, D2D1_ANTIALIAS_MODE_ALIASED);
         }
 
         ~clip()
         {
-            rtarget->get_target()->PopAxisAlignedClip();
+            rtarget->flushed_target()->PopAxisAlignedClip();
         }
     };
 
@@ -61,14 +79,14 @@ namespace drawing
 
         transform(target& t, matrix3x2 const& m) : tgt(t)
         {
-            auto native = t.rtarget->get_target();
+            auto native = t.rtarget->flushed_target();
             native->GetTransform(&old);
             native->SetTransform(m);
         }
 
         ~transform()
         {
-            tgt.rtarget->get_target()->SetTransform(old);
+            tgt.rtarget->flushed_target()->SetTransform(old);
         }
     };
 }
\ No newline at end of file
@@ -1,24 +1,55 @@
 #pragma once
 
-#include <d2d1.h>
+#include <algorithm>
+
+// The geometry types share their layout with the Direct2D ones, and derive
+// from them on Windows so they can be handed to Direct2D as they are.
+// Elsewhere they stand alone, so the layout and hit testing code builds
+// without d2d1.h.
+#if defined(_WIN32) && !defined(GEOMETRY_D2D)
+#define GEOMETRY_D2D
+#endif
 
+#ifdef GEOMETRY_D2D
+#include <d2d1.h>
 #undef min
+#undef max
+#endif
 
 namespace drawing
 {
-    typedef FLOAT distance;
-    typedef FLOAT degrees;
+#ifdef GEOMETRY_D2D
+    typedef D2D_POINT_2F point_base;
+    typedef D2D_RECT_F rectangle_base;
+#else
+    struct point_base
+    {
+        float x;
+        float y;
+    };
+
+    struct rectangle_base
+    {
+        float left;
+        float top;
+        float right;
+        float bottom;
+    };
+#endif
+
+    typedef float distance;
+    typedef float degrees;
 
     struct point;
     struct line;
     struct rectangle;
     
-    struct point : D2D_POINT_2F
+    struct point : point_base
     {
         point(distance x, distance y)
-        : D2D_POINT_2F({ x, y }) {}
+        : point_base({ x, y }) {}
 
-        point() : D2D_POINT_2F({ 0, 0 }) {}
+        point() : point_base({ 0, 0 }) {}
     };
 
     struct line
@@ -37,12 +68,12 @@ namespace drawing
         }
     }; 
 
-    struct rectangle : D2D_RECT_F
+    struct rectangle : rectangle_base
     {
         rectangle(distance left, distance top, distance right, distance bottom)
-            : D2D_RECT_F({ left, top, right, bottom }) {}
+            : rectangle_base({ left, top, right, bottom }) {}
 
-        rectangle() : D2D_RECT_F({ 0, 0, 0, 0 }) {}
+        rectangle() : rectangle_base({ 0, 0, 0, 0 }) {}
 
         distance height() const { return bottom - top; }
         distance width() const { return right - left; }
@@ -64,9 +95,26 @@ namespace drawing
         }
     };
 
+#ifdef GEOMETRY_D2D
     typedef D2D1_MATRIX_3X2_F matrix3x2;
 
     typedef D2D1_COLOR_F color;
+#else
+    struct matrix3x2
+    {
+        float _11, _12;
+        float _21, _22;
+        float _31, _32;
+    };
+
+    struct color
+    {
+        float r;
+        float g;
+        float b;
+        float a;
+    };
+#endif
 
     bool empty(rectangle const& r)
     {
@@ -162,6 +210,13 @@ namespace drawing
             r.bottom);
     }
 
+    rectangle translate(rectangle const& r, distance dx, distance dy)
+    {
+        return rectangle(
+            r.left + dx, r.top + dy,
+            r.right + dx, r.bottom + dy);
+    }
+
     rectangle inside(rectangle const& r, distance d)
     {
         return rectangle(
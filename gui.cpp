@@ -5,276 +5,2046 @@
 #include "gui.h"
 #include "ui.h"
 #include "tree.h"
+#include "snapshot.h"
+#include "model.h"
+#include "loader.h"
+#include "sort.h"
+#include "shared_tree.h"
+#include "tree_mirror.h"
+#include "aggregate.h"
+#include "scroll.h"
+#include "layout.h"
+#include "outline.h"
+#include "state.h"
+#include "selection.h"
+#include "table.h"
+#include "async.h"
+#include "allocations.h"
+#include "profile.h"
+#include "startup.h"
+#include "detail.h"
 
 #include <dwrite.h>
 #pragma comment(lib, "dwrite")
 
-#include <iostream>
 #include <vector>
 #include <list>
+#include <sstream>
 #include <deque>
 #include <string>
+#include <memory>
 #include <thread>
+#include <atomic>
+#include <random>
+#include <ctime>
+#include <cwchar>
 #include <boost/optional.hpp>
-#include <boost/asio/deadline_timer.hpp>
-#include <boost/date_time/posix_time/posix_time_duration.hpp>
 
 using namespace drawing;
 
+// Declared first, so its clock starts before any other global is made.
+diagnostics::startup_timeline startup;
+
 boost::asio::io_service io;
-boost::asio::deadline_timer timer(io);
-drawing::factory f;
-text::factory tf;
-ui::window w(f);
 
-text::format text_format(tf, L"Arial", NULL,
-    DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL,
-    DWRITE_FONT_STRETCH_NORMAL, 12.0f, L"en-us");
+// The factories, window and fonts are made by _tWinMain rather than during
+// static initialization, so that their cost shows in the startup timeline
+// and the fonts can be made while the window comes up.
+std::unique_ptr<drawing::factory> d2d_factory;
+
+struct text_resources
+{
+    text::factory factory;
+    text::format format;
+    text::ellipses dots;
+    text::glyph_cache glyphs;
+
+    text_resources()
+        : format(factory, L"Arial", NULL,
+            DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL,
+            DWRITE_FONT_STRETCH_NORMAL, 12.0f, L"en-us"),
+        dots(factory, format),
+        glyphs(factory, format)
+    {
+    }
+};
+
+// Null until load_fonts() has handed them to the UI thread; frames drawn
+// before then show no text.
+std::unique_ptr<text_resources> fonts;
+text::glyph_run label_run;
+
+std::list<std::function<void()> > timers;
+
+// Window that runs the flows not tied to one view, and all open windows;
+// defined with the windows below.
+ui::window& main_window();
+void invalidate_content();
+void invalidate_layout();
+
+auto write_label = [&](target& t, std::wstring_view s, drawing::rectangle const& r)
+{
+    TRACE_ZONE("write_label");
+
+    if (fonts->glyphs.shape(s, r.width(), label_run))
+    {
+        drawing::write(t,
+            point(r.left, r.top), fonts->glyphs, label_run,
+            { 0.0, 0.0, 0.0, 1.0 });
+        return;
+    }
+
+    // Bidi, combining marks and font fallback need a full layout.
+    text::layout l(fonts->factory, s, fonts->format, r.width(), r.height());
+    DWRITE_TRIMMING opts;
+    opts.delimiter = 0;
+    opts.delimiterCount = 0;
+    opts.granularity = DWRITE_TRIMMING_GRANULARITY_CHARACTER;
+    l.ptr->SetTrimming(&opts, fonts->dots.ptr);
+
+    drawing::write(t,
+        point(r.left, r.top), l,
+        { 0.0, 0.0, 0.0, 1.0 });
+};
+
+typedef model::node node;
+
+model::tree_model document(L"");
+
+// Expander animation of a row.  Rows that are not animating hold nothing
+// the model cannot tell, so their entries may be dropped at any time.
+struct expander_state
+{
+    enum { idle, expanding, collapsing } phase;
+    ui::frame_clock::time_point start;
+    degrees angle;
+
+    expander_state() : phase(idle), angle(0) {}
+
+    expander_state(node const& n) : phase(idle), angle(n.expanded ? 90.0f : 0.0f) {}
+};
+
+ui::state_table<expander_state> expanders;
+
+// Turns the expander of 'n' a step every frame, then changes the model.
+// The state is looked up again after each frame since the table may have
+// moved it; once it is gone, 'n' may be too, having been removed from the
+// model, and the animation ends without touching it.
+ui::async animate_expander(node& n, bool expanding)
+{
+    const std::chrono::duration<float> d(0.1);
+    auto id = n.id;
+
+    for (;;)
+    {
+        co_await ui::next_frame(main_window());
+        if (main_window().closed()) co_return;
+
+        auto s = expanders.find(ui::widget_id(id));
+        if (s == nullptr) co_return;
+
+        std::chrono::duration<float> elapsed = ui::frame_clock::now() - s->start;
+        auto ratio = elapsed.count() / d.count();
+
+        if (elapsed > d)
+        {
+            s->phase = expander_state::idle;
+            s->angle = expanding ? 90.0f : 0.0f;
+            break;
+        }
+
+        s->angle = expanding ? 90 * ratio : 90 - 90 * ratio;
+        invalidate_content();
+    }
+
+    document.set_expanded(n, expanding);
+}
+
+void toggle(node& n)
+{
+    auto& s = expanders.get(ui::widget_id(n.id), expander_state(n));
+    if (s.phase != expander_state::idle) return;
+
+    bool expanding = !n.expanded;
+
+    s.phase = expanding ? expander_state::expanding : expander_state::collapsing;
+    s.start = ui::frame_clock::now();
+
+    animate_expander(n, expanding);
+}
+
+// Data columns of the tree-table, indexed by node id.
+ui::column_data<uint64_t> sizes;
+ui::column_data<std::time_t> modified;
+ui::column_data<uint8_t> statuses;
+
+// Subtree aggregates: the nodes below each node, and the total size of its
+// subtree.
+model::aggregate<uint64_t> descendants(
+    [](node const&) -> uint64_t { return 1; },
+    std::plus<uint64_t>(), 0, std::minus<uint64_t>());
+
+model::aggregate<uint64_t> total_sizes(
+    [](node const& n) -> uint64_t { auto s = sizes.find(n.id); return s ? *s : 0; },
+    std::plus<uint64_t>(), 0, std::minus<uint64_t>());
+
+void format_bytes(uint64_t bytes, std::wstring& text)
+{
+    static const wchar_t* units[] = { L"B", L"KB", L"MB", L"GB", L"TB" };
+
+    double v = (double)bytes;
+    int unit = 0;
+    for (; v >= 1024 && unit < 4; unit++) v /= 1024;
+
+    wchar_t buffer[32];
+    swprintf(buffer, 32, unit == 0 ? L"%.0f %ls" : L"%.1f %ls", v, units[unit]);
+    text = buffer;
+}
+
+bool format_size(uint32_t key, std::wstring& text)
+{
+    auto bytes = sizes.find(key);
+    if (bytes == nullptr) return false;
+
+    format_bytes(*bytes, text);
+    return true;
+}
+
+bool format_items(uint32_t key, std::wstring& text)
+{
+    auto count = descendants.find(key);
+    if (count == nullptr || *count <= 1) return false;
+
+    text = std::to_wstring(*count - 1);
+    return true;
+}
+
+bool format_total(uint32_t key, std::wstring& text)
+{
+    auto bytes = total_sizes.find(key);
+    if (bytes == nullptr || *bytes == 0) return false;
+
+    format_bytes(*bytes, text);
+    return true;
+}
+
+bool format_modified(uint32_t key, std::wstring& text)
+{
+    auto t = modified.find(key);
+    if (t == nullptr) return false;
+
+    wchar_t buffer[32];
+    if (wcsftime(buffer, 32, L"%Y-%m-%d %H:%M", std::gmtime(t)) == 0) return false;
+    text = buffer;
+    return true;
+}
+
+bool format_status(uint32_t key, std::wstring& text)
+{
+    static const wchar_t* names[] = { L"OK", L"Pending", L"Failed" };
+
+    auto s = statuses.find(key);
+    if (s == nullptr || *s > 2) return false;
+    text = names[*s];
+    return true;
+}
+
+// Made-up column values for the demo tree.
+void fill_columns(node const& n, std::time_t now)
+{
+    sizes.set(n.id, (uint64_t)(n.name.length() + 1) * 1536 * n.id);
+    modified.set(n.id, now - (std::time_t)n.id * 3600);
+    statuses.set(n.id, (uint8_t)(n.id % 3));
+
+    for (auto& c : n.children) fill_columns(c, now);
+}
+
+// Order the tree is shown in, and the column it is sorted by.
+model::tree_sort sorting;
+size_t sort_column = ui::table_columns::none;
+
+// Sorts by column 'c', or flips the direction if already sorted by it.
+void sort_by(size_t c)
+{
+    if (c == sort_column)
+    {
+        sorting.reverse();
+        return;
+    }
+
+    sort_column = c;
+    if (c == 0)
+    {
+        sorting.by_name(false);
+        return;
+    }
+
+    sorting.by_number([c](node const& n) -> int64_t
+    {
+        switch (c)
+        {
+        case 1: { auto v = sizes.find(n.id); return v ? (int64_t)*v : -1; }
+        case 2: { auto v = modified.find(n.id); return v ? (int64_t)*v : -1; }
+        case 3: { auto v = statuses.find(n.id); return v ? (int64_t)*v : -1; }
+        case 4: { auto v = descendants.find(n.id); return v ? (int64_t)*v : -1; }
+        default: { auto v = total_sizes.find(n.id); return v ? (int64_t)*v : -1; }
+        }
+    }, false);
+}
+
+// The document as a tree adapter (see tree.h), children in the sort order
+// if there is one.  Views over it lay out and paint rows as they do over
+// any other adapter; expansion stays with the nodes, shared by all windows.
+class document_tree
+{
+public:
+    typedef node* handle;
+
+    // Walks either the children themselves or their sorted permutation.
+    class child_iterator : public boost::iterator_facade<
+        child_iterator, node*, boost::forward_traversal_tag, node*>
+    {
+        friend class boost::iterator_core_access;
+
+        std::list<node>::iterator _child;
+        std::vector<node*>::const_iterator _sorted;
+        bool _in_order;
+
+        node* dereference() const { return _in_order ? *_sorted : &*_child; }
+
+        void increment()
+        {
+            if (_in_order) ++_sorted;
+            else ++_child;
+        }
+
+        bool equal(child_iterator const& other) const
+        {
+            return _in_order ? _sorted == other._sorted : _child == other._child;
+        }
+
+    public:
+        child_iterator() : _in_order(false) {}
+        child_iterator(std::list<node>::iterator it) : _child(it), _in_order(false) {}
+        child_iterator(std::vector<node*>::const_iterator it) : _sorted(it), _in_order(true) {}
+    };
+
+private:
+    node& _root;
+
+public:
+    document_tree(node& root) : _root(root) {}
+
+    handle root() const { return &_root; }
+
+    std::pair<child_iterator, child_iterator> children(handle h) const
+    {
+        if (sorting.active())
+        {
+            auto& order = sorting.children(*h);
+            return std::make_pair(child_iterator(order.begin()), child_iterator(order.end()));
+        }
+        return std::make_pair(child_iterator(h->children.begin()), child_iterator(h->children.end()));
+    }
+
+    handle handle_of(child_iterator it) const { return *it; }
+
+    // Children may still be loaded on expansion, so every row can expand.
+    bool expandable(handle) const { return true; }
+
+    void label(handle h, std::wstring& text) const { text = h->name; }
+    distance row_height(handle) const { return 20; }
+};
+
+// Formatted and shaped text of one table cell.  Entries are dropped once
+// the cell has not been painted for a while.
+struct cell_text
+{
+    uint32_t generation;
+    std::wstring text;
+
+    // Width 'run' was fitted to; only a resize of the cell's own column
+    // makes it fit again.
+    distance width;
+    bool shaped;
+    text::glyph_run run;
+
+    cell_text() : generation(uint32_t(-1)), width(-1), shaped(false) {}
+};
+
+ui::state_table<cell_text> cells(60, 256);
+
+struct tree_view
+{
+    node& root;
+    document_tree tree;
+    ui::tree_layout<document_tree::handle> layout;
+    ui::table_columns columns;
+    ui::scroller scroll;
+    drawing::scroll_surface surface;
+    ui::detail_tracker detail;
+    rectangle header;
+    rectangle viewport;
+    node const* hovered;
+    ui::selection selected;
+
+    // Row of each laid out node, by node id; entries for nodes that have
+    // no row in the current layout are stale.
+    std::vector<uint32_t> rows_by_id;
+
+    // Reused by each layout pass.
+    std::vector<ui::outline_level<document_tree> > arranging;
+
+    tree_view(node& r) : root(r), tree(r), columns(L"Name", 160), hovered(nullptr)
+    {
+        columns.add(L"Size", 70, true, format_size);
+        columns.add(L"Modified", 110, false, format_modified);
+        columns.add(L"Status", 60, false, format_status);
+        columns.add(L"Items", 60, true, format_items);   // items_column
+        columns.add(L"Total", 70, true, format_total);   // total_column
+    }
+};
+
+typedef ui::tree_layout<document_tree::handle> tree_layout;
+
+// Columns showing the subtree aggregates.
+enum { items_column = 4, total_column = 5 };
+
+// One window onto the document.  Windows share the factories, the fonts,
+// the model with its sort order and aggregates, and the cell and expander
+// caches; each has its own render target, scroll surface, layout,
+// selection and frame schedule.
+struct tree_window
+{
+    ui::window w;
+    tree_view tv;
+    point mouse;
+
+    // Set when something other than the scroll offset changed, so the
+    // cached tree view content has to be repainted in full.
+    bool content_changed;
+
+    // Set when rows appeared, disappeared or moved, so the tree view has
+    // to be laid out again.
+    bool layout_changed;
+
+    // Share of the tree viewport repainted by the last frame, rows
+    // selected, and global heap allocations made by the last frame with
+    // the allocation counting hook enabled.
+    int painted_percent;
+    size_t selected_count;
+    size_t frame_allocations;
+
+    // Frames painted so far.  A frame after the first warm_up_frames that
+    // neither laid out rows nor changed the viewport or scroll offset is
+    // steady: it only repaints from caches and must not touch the heap.
+    enum { warm_up_frames = 30 };
+    size_t frames;
+    bool steady;
+    distance painted_offset;
+    size_t steady_frames;
+    size_t allocating_frames;
+
+    // Left-button drags further than drag_threshold scroll instead of
+    // clicking.
+    boost::optional<point> drag_origin;
+    distance drag_offset;
+    bool dragging;
+
+    // Column being resized by dragging its divider in the header.
+    size_t resizing;
+    distance resize_origin;
+    distance resize_width;
+
+    // Set while restore_detail() waits for motion to settle.
+    bool restoring_detail;
+
+    // Destroyed, and freed once the message loop gets control back.
+    bool closed;
+
+    tree_window(node& root)
+        : tv(root), content_changed(true), layout_changed(true),
+        painted_percent(100), selected_count(0), frame_allocations(0),
+        frames(0), steady(false), painted_offset(0), steady_frames(0), allocating_frames(0),
+        drag_offset(0), dragging(false),
+        resizing(ui::table_columns::none), resize_origin(0), resize_width(0),
+        restoring_detail(false), closed(false)
+    {
+    }
+
+    void invalidate_content()
+    {
+        content_changed = true;
+        w.redraw();
+    }
+
+    void invalidate_layout()
+    {
+        layout_changed = true;
+        invalidate_content();
+    }
+
+    // Bytes this window holds that no other window shares.
+    size_t memory() const
+    {
+        return w.memory() + tv.surface.memory() + tv.layout.memory();
+    }
+};
+
+const distance drag_threshold = 4;
+
+// Open windows, the first being the main one: closing it closes the rest
+// and ends the program.  The list only changes on the UI thread, under the
+// lock, so that other threads can ask for repaints.
+std::list<std::unique_ptr<tree_window> > windows;
+std::mutex windows_lock;
+
+ui::window& main_window()
+{
+    return windows.front()->w;
+}
+
+void invalidate_content()
+{
+    for (auto& tw : windows) tw->invalidate_content();
+}
+
+void invalidate_layout()
+{
+    for (auto& tw : windows) tw->invalidate_layout();
+}
+
+// Asks every window for a frame; may be called from any thread.
+void redraw_windows()
+{
+    std::lock_guard<std::mutex> hold(windows_lock);
+    for (auto& tw : windows) tw->w.redraw();
+}
+
+// Frees the windows closed while the last message was handled.
+void free_closed_windows()
+{
+    std::lock_guard<std::mutex> hold(windows_lock);
+    for (auto it = std::next(windows.begin()); it != windows.end();)
+    {
+        if ((*it)->closed) it = windows.erase(it);
+        else ++it;
+    }
+}
+
+// Bytes of the caches all windows share.
+size_t shared_memory()
+{
+    return (fonts ? fonts->glyphs.memory() : 0) + cells.memory() + expanders.memory();
+}
+
+// Keeps frames coming while a view scrolls towards its target.  Both
+// belong to the window, so the loop ends when it closes.
+ui::async animate_scroll(ui::window& w, ui::scroller& scroll)
+{
+    while (scroll.animating())
+    {
+        co_await ui::next_frame(w);
+        if (w.closed()) co_return;
+    }
+}
+
+// Repaints the tree view in full detail once it has stopped moving fast.
+ui::async restore_detail(tree_window& win)
+{
+    win.restoring_detail = true;
+
+    auto& detail = win.tv.detail;
+    while (detail.level() == ui::coarse_detail)
+    {
+        co_await ui::delay(win.w, (unsigned)detail.until_settled().count() + 1);
+        if (win.w.closed()) co_return;
+
+        if (detail.until_settled().count() == 0)
+        {
+            win.invalidate_content();
+            co_await ui::next_frame(win.w);
+            if (win.w.closed()) co_return;
+        }
+    }
+
+    win.restoring_detail = false;
+}
+
+// Layout pass over the document, expanded where its nodes are.
+void arrange_tree_view(tree_view& view, distance width)
+{
+    auto& layout = view.layout;
+    ui::arrange_rows(view.tree, [](node* n) { return n->is_expanded(); },
+        10, width, layout, view.arranging);
+
+    for (size_t i = 0; i < layout.size(); i++)
+    {
+        auto id = layout.at(i).node->id;
+        if (id >= view.rows_by_id.size()) view.rows_by_id.resize(id + 1);
+        view.rows_by_id[id] = (uint32_t)i;
+    }
+
+    layout.commit();
+}
+
+// Row of 'n' in the current layout, or the layout's size if it has none.
+size_t row_of(tree_view const& view, node const& n)
+{
+    auto& layout = view.layout;
+    if (n.id >= view.rows_by_id.size()) return layout.size();
+
+    size_t row = view.rows_by_id[n.id];
+    return row < layout.size() && layout.at(row).node == &n ? row : layout.size();
+}
+
+// Triangle of an expander in 't', turned 'angle' degrees from pointing
+// right; 90 points down.
+void draw_expander(target& t, degrees angle)
+{
+    auto bounds = centered(t, point(8, 8));
+    auto p1 = bounds.top_left();
+    auto p2 = bounds.center();
+    auto p3 = bounds.bottom_left();
+
+    transform rot(t, D2D1::Matrix3x2F::Rotation(angle, center(bounds)));
+    draw(t, line(p1, p2), { 0, 0, 0, 1 });
+    draw(t, line(p2, p3), { 0, 0, 0, 1 });
+    draw(t, line(p3, p1), { 0, 0, 0, 1 });
+}
+
+// Label and expander of row 'r' of any tree layout, the label ending at
+// 'label_right' at the latest; 'content' is positioned at the layout
+// origin.  Rows that cannot expand get no expander.
+template <typename Row>
+void paint_tree_row(target& content, Row const& r, distance label_right,
+    std::wstring_view text, bool expandable, degrees angle, bool hovered)
+{
+    auto name = r.label;
+    name.right = (std::min)(name.right, label_right);
+
+    target label(content, translate(name, content.left, content.top));
+    if (hovered) fill(label, { 0.8, 1, 0.8, 1 });
+    write_label(content, text, centered(label, point(label.width(), 15)));
+
+    if (!expandable) return;
+
+    target expander(content, translate(r.expander, content.left, content.top));
+    draw_expander(expander, angle);
+}
+
+// Rows 'n' shows below its own when expanded.
+size_t visible_rows(node const& n)
+{
+    size_t rows = 0;
+    if (n.is_expanded())
+        for (auto& c : n.children) rows += 1 + visible_rows(c);
+    return rows;
+}
+
+// Text of column 'c' in row 'r', formatted once and re-fitted only when
+// the column's width changes.
+void paint_cell(target& content, ui::table_columns const& columns,
+    tree_layout::row const& r, size_t c)
+{
+    auto& column = columns.at(c);
+    auto bounds = columns.cell(r.bounds, c);
+    bounds.left += 4;
+    bounds.right -= 4;
+    if (bounds.right <= bounds.left) return;
+
+    auto& cell = cells.get(ui::widget_id(r.node->id, (uint32_t)c));
+    if (cell.generation != column.generation)
+    {
+        cell.text.clear();
+        if (!column.format(r.node->id, cell.text)) cell.text.clear();
+        cell.generation = column.generation;
+        cell.width = -1;
+    }
+    if (cell.text.empty()) return;
+
+    if (cell.width != bounds.width())
+    {
+        cell.shaped = fonts->glyphs.shape(cell.text, bounds.width(), cell.run);
+        cell.width = bounds.width();
+    }
+
+    auto box = centered(translate(bounds, content.left, content.top),
+        point(bounds.width(), 15));
+
+    if (!cell.shaped)
+    {
+        write_label(content, cell.text, box);
+        return;
+    }
+
+    auto x = column.align_right ? box.right - cell.run.width : box.left;
+    drawing::write(content, point(x, box.top), fonts->glyphs, cell.run, { 0, 0, 0, 1 });
+}
+
+// Paint pass: 'content' is positioned at the layout origin.
+void paint_row(target& content, ui::table_columns const& columns,
+    tree_layout::row const& r, bool hovered)
+{
+    auto& state = expanders.get(ui::widget_id(r.node->id), expander_state(*r.node));
+    paint_tree_row(content, r, columns.cell(r.bounds, 0).right, r.node->name,
+        true, state.angle, hovered);
+
+    for (size_t c = 1; c < columns.size(); c++)
+        paint_cell(content, columns, r, c);
+}
+
+// Stand-in for a row while the view moves too fast to read it: bars about
+// as wide as its text, from widths already known, with no shaping and no
+// expander triangle.  Bars of one colour batch into a single submission.
+void sketch_row(target& content, ui::table_columns const& columns,
+    tree_layout::row const& r, bool hovered)
+{
+    const color bar = { 0.8, 0.8, 0.8, 1 };
+    auto advance = fonts->glyphs.line_height() / 2;
+
+    auto name = r.label;
+    name.right = (std::min)(name.right, columns.cell(r.bounds, 0).right);
+    target label(content, translate(name, content.left, content.top));
+    if (hovered) fill(label, { 0.8, 1, 0.8, 1 });
+
+    auto text = centered(label, point(label.width(), 6));
+    text.right = (std::min)(text.right, text.left + advance * r.node->name.length());
+    fill(content, text, bar);
+
+    auto expander = translate(r.expander, content.left, content.top);
+    fill(content, centered(expander, point(4, 4)), bar);
+
+    for (size_t c = 1; c < columns.size(); c++)
+    {
+        auto cell = cells.find(ui::widget_id(r.node->id, (uint32_t)c));
+        if (!cell || cell->generation != columns.at(c).generation || cell->text.empty())
+            continue;
+
+        auto bounds = columns.cell(r.bounds, c);
+        bounds.left += 4;
+        bounds.right -= 4;
+        if (bounds.right <= bounds.left) continue;
+
+        auto width = (std::min)(bounds.width(), cell->shaped && cell->width == bounds.width()
+            ? cell->run.width : advance * cell->text.length());
+        auto box = centered(translate(bounds, content.left, content.top),
+            point(bounds.width(), 6));
+        if (columns.at(c).align_right) box.left = box.right - width;
+        else box.right = box.left + width;
+        fill(content, box, bar);
+    }
+}
+
+// Column titles above the tree viewport, with the dividers that resize
+// the columns.
+void draw_table_header(target& t, ui::table_columns const& columns)
+{
+    fill(t, { 0.93, 0.93, 0.93, 1 });
+
+    for (size_t c = 0; c < columns.size(); c++)
+    {
+        auto& column = columns.at(c);
+        auto x = t.left + column.left + column.width;
+
+        drawing::frame_text title(*t.arena);
+        title << column.title;
+        if (c == sort_column)
+            title << (sorting.descending() ? L" \x25bc" : L" \x25b2");
+
+        rectangle cell(t.left + column.left + 4, t.top, x - 4, t.bottom);
+        if (cell.right > cell.left)
+            write_label(t, title.view(), centered(cell, point(cell.width(), 15)));
+
+        draw(t, line(point(x, t.top), point(x, t.bottom)), { 0.6, 0.6, 0.6, 1 });
+    }
+
+    draw(t, t.bottom_edge(), { 0.6, 0.6, 0.6, 1 });
+}
+
+// Time from the start of the process until the first frame was presented,
+// and until the first one with text.
+boost::optional<std::chrono::milliseconds> first_frame;
+boost::optional<std::chrono::milliseconds> first_full_frame;
+
+std::chrono::milliseconds since_startup()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        diagnostics::startup_timeline::clock::now() - startup.start());
+}
+
+// Collation keys of the rows, made in idle time as nodes arrive so that
+// the first sort by name does not stall on the locale.  Only children of
+// expanded nodes are keyed, as those are all a sort orders.
+std::vector<node*> unkeyed;
+bool keying_pending = false;
+
+void key_rows(model::change_list const& changes)
+{
+    for (auto& c : changes)
+    {
+        switch (c.kind)
+        {
+        case model::change::insert:
+            for (auto it = c.first;; ++it)
+            {
+                unkeyed.push_back(&*it);
+                if (it == c.last) break;
+            }
+            break;
+
+        case model::change::remove:
+            // Nodes waiting to be keyed may be gone, so the walk starts
+            // over from the root; keys already made are kept.
+            unkeyed.assign(1, &document.root());
+            break;
+
+        case model::change::rename:
+            unkeyed.push_back(c.target);
+            break;
+
+        case model::change::expand:
+            if (c.target->expanded)
+                for (auto& n : c.target->children) unkeyed.push_back(&n);
+            break;
+
+        case model::change::move:
+            break;
+        }
+    }
+
+    if (keying_pending || unkeyed.empty()) return;
+    keying_pending = true;
+
+    main_window().post_idle([](ui::idle_scheduler::slice const&)
+    {
+        std::vector<node*> nodes;
+        while (!unkeyed.empty() && nodes.size() < 256)
+        {
+            auto n = unkeyed.back();
+            unkeyed.pop_back();
+            nodes.push_back(n);
+
+            if (n->expanded)
+                for (auto& c : n->children) unkeyed.push_back(&c);
+        }
+        sorting.prepare_keys(nodes);
+
+        if (!unkeyed.empty()) return true;
+        keying_pending = false;
+        return false;
+    }, ui::idle_scheduler::low);
+}
+
+// Why the document named on the command line could not be opened, if it
+// could not; the window then starts with an empty document.
+std::wstring open_error;
+
+void failed_to_open(std::wstring const& path, char const* reason)
+{
+    std::string r(reason);
+    open_error = path + L": " + std::wstring(r.begin(), r.end());
+}
+
+// A JSON or XML document being read in on the io thread.
+struct streaming_document
+{
+    std::unique_ptr<model::document_loader> loader;
+    std::unique_ptr<model::document_source> values;
+
+    // Bytes parsed as of the last batch handed to the model.
+    uint64_t loaded;
+    bool done;
+    std::wstring error;
+};
+
+streaming_document streaming;
+
+// Parses on the io thread and hands the nodes over to the UI thread a
+// frame's worth at a time, so the first levels can be shown and browsed
+// while the rest of the document is still being read, and the windows lay
+// out their rows once per frame rather than once per batch.  Leaf values
+// stay in the file until their node is expanded.
+ui::async stream_document(node& top)
+{
+    const size_t batch_size = 2048;
+    const auto handoff = std::chrono::milliseconds(16);
+
+    std::vector<model::staged_node> batch;
+    batch.reserve(batch_size);
+
+    for (bool more = true; more;)
+    {
+        co_await ui::resume_on_io(io);
+
+        std::string error;
+        try
+        {
+            auto until = std::chrono::steady_clock::now() + handoff;
+            do more = streaming.loader->read(batch, batch.size() + batch_size);
+            while (more && std::chrono::steady_clock::now() < until);
+        }
+        catch (std::exception const& e)
+        {
+            error = e.what();
+            more = false;
+        }
+        auto loaded = streaming.loader->offset();
+
+        co_await ui::resume_on_ui(main_window());
+
+        streaming.loader->append(document, top, batch, *streaming.values);
+        streaming.loaded = loaded;
+        streaming.error.assign(error.begin(), error.end());
+        redraw_windows();
+    }
+
+    streaming.done = true;
+    redraw_windows();
+}
+
+// Makes the fonts on the io thread while the UI thread creates the window
+// and loads the document, then hands them over and lays out with text.
+ui::async load_fonts()
+{
+    co_await ui::resume_on_io(io);
+
+    std::unique_ptr<text_resources> made;
+    {
+        diagnostics::startup_timeline::scope phase(startup, "fonts");
+        made.reset(new text_resources());
+    }
+
+    co_await ui::resume_on_ui(main_window());
+
+    fonts = std::move(made);
+    invalidate_layout();
+}
+
+// Writes the startup timeline to the debugger's output window.
+void report_startup()
+{
+    std::ostringstream out;
+    out << "Startup:\n";
+    startup.write(out);
+    ::OutputDebugStringA(out.str().c_str());
+}
+
+// A tree edited by background threads, and the model's copy of it, which
+// each frame brings up to the latest version.
+std::unique_ptr<model::shared_tree> feed_tree;
+std::unique_ptr<model::tree_mirror> feed_mirror;
+
+// One random edit picked by 'choice': mostly an append under a random
+// node, sometimes a rename or a removal.
+void random_edit(model::shared_tree& tree, uint32_t choice)
+{
+    tree.write([choice](model::shared_tree::edit& e)
+    {
+        std::mt19937 r(choice);
+        model::shared_tree::path p;
+
+        auto n = &e.root();
+        while (!n->children.empty() && r() % 3 != 0)
+        {
+            auto i = (uint32_t)(r() % n->children.size());
+            p.push_back(i);
+            n = n->children[i];
+        }
+
+        auto kind = choice % 100;
+        if (kind < 70 || p.empty())
+        {
+            e.append(p, L"item " + std::to_wstring(r() % 10000));
+        }
+        else if (kind < 85)
+        {
+            e.rename(p, L"renamed " + std::to_wstring(r() % 10000));
+        }
+        else
+        {
+            auto i = p.back();
+            p.pop_back();
+            e.remove(p, i);
+        }
+    });
+}
+
+// Makes random edits to 'tree' until 'stopping'.
+void produce(model::shared_tree& tree, std::atomic<bool>& stopping, unsigned seed)
+{
+    std::mt19937 random(seed);
+
+    while (!stopping)
+    {
+        random_edit(tree, random());
+        redraw_windows();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
+
+// Milliseconds to one decimal place.
+void write_ms(drawing::frame_text& text, float ms)
+{
+    auto tenths = (long long)(ms * 10 + 0.5f);
+    text << tenths / 10 << L"." << tenths % 10 << L" ms";
+}
+
+// The status line is rebuilt every frame, in the frame's arena.
+target draw_status(target& t, tree_window const& win)
+{
+    drawing::frame_text status_text(*t.arena, 200);
+
+    status_text << L"Pointer: " << (int)win.mouse.x << L", " << (int)win.mouse.y;
+
+    if (first_frame)
+        status_text << L"  First frame: " << (long long)first_frame->count() << L" ms";
+
+    if (first_full_frame)
+        status_text << L" (text " << (long long)first_full_frame->count() << L" ms)";
+
+    status_text << L"  Painted: " << win.painted_percent << L"%";
+
+    // Time to paint the tree view at each level of detail, so the saving
+    // of coarse frames shows while flinging.
+    auto& detail = win.tv.detail;
+    if (detail.frame_ms(ui::coarse_detail) > 0)
+    {
+        status_text << L"  Detail: " <<
+            (detail.level() == ui::coarse_detail ? L"coarse (" : L"full (");
+        write_ms(status_text, detail.frame_ms(ui::full_detail));
+        status_text << L" full, ";
+        write_ms(status_text, detail.frame_ms(ui::coarse_detail));
+        status_text << L" coarse)";
+    }
+
+    if (win.selected_count > 0)
+        status_text << L"  Selected: " << win.selected_count;
+
+    // The root's descendant count is kept up to date with every edit.
+    if (auto all = descendants.find(document.root().id))
+        status_text << L"  Nodes: " << (long long)(*all - 1);
+
+    if (streaming.loader && !streaming.done && streaming.loader->size() > 0)
+        status_text << L"  Loading: " <<
+            (int)(100 * streaming.loaded / streaming.loader->size()) << L"%";
+
+    if (!streaming.error.empty())
+        status_text << L"  Load failed: " << streaming.error;
+
+    if (!open_error.empty())
+        status_text << L"  Open failed: " << open_error;
+
+    auto& idle = win.w.idle();
+    if (idle.last_budget().count() > 0)
+    {
+        typedef std::chrono::duration<double, std::milli> ms;
+        status_text << L"  Idle: " <<
+            (int)(100 * ms(idle.last_used()).count() / ms(idle.last_budget()).count()) <<
+            L"% of " << (int)ms(idle.last_budget()).count() << L" ms";
+    }
+
+    if (diagnostics::counting_allocations())
+        status_text << L"  Allocations: " << win.frame_allocations;
+
+    auto& batching = win.w.batching();
+    if (batching.primitives > 0)
+        status_text << L"  Batched: " << batching.saved() << L" of " <<
+            batching.primitives << L" brushes saved";
+
+    size_t all = 0;
+    for (auto& tw : windows) all += tw->memory();
+    status_text << L"  Memory: " << (long long)(win.memory() / 1024) << L" KB";
+    if (windows.size() > 1)
+        status_text << L" of " << (long long)(all / 1024) << L" KB in " <<
+            windows.size() << L" windows";
+    status_text << L", shared " << (long long)(shared_memory() / 1024) << L" KB";
+
+    draw(t, t.top_edge(), { 0, 0, 0, 1 });
+    write_label(t, status_text.view(), centered(t, point(t.width(), 12)));
+    return t;
+}
+
+// Keeps the selection on the same nodes when 'n' has just been expanded or
+// collapsed: the rows below it move by the number of its descendant rows.
+// Uses the layout from before the change.
+void shift_selection(tree_view& view, node const& n)
+{
+    auto& layout = view.layout;
+
+    auto row = row_of(view, n);
+    if (row == layout.size())
+    {
+        view.selected.clear();
+        return;
+    }
+
+    auto& r = layout.at(row);
+    if (n.is_expanded())
+    {
+        view.selected.insert_rows(row + 1, visible_rows(n));
+    }
+    else if (r.expanded)
+    {
+        auto hidden = layout.rows_in(r.children.top, r.children.bottom);
+        view.selected.remove_rows(row + 1, hidden.second - hidden.first);
+    }
+}
+
+// Repaints the row of 'n' alone, if it has one.
+void repaint_row(tree_window& win, node const& n)
+{
+    auto& view = win.tv;
+    auto row = row_of(view, n);
+    if (row == view.layout.size()) return;
+
+    auto& bounds = view.layout.at(row).bounds;
+    view.surface.invalidate(bounds.top, bounds.bottom);
+    win.w.redraw();
+}
+
+// Nodes whose descendant count or total size an edit changed: the
+// ancestors of what was inserted, removed or moved, and of expanded nodes,
+// which may have loaded children.  Their aggregate cells are marked to be
+// formatted again.  Runs of edits under one parent are walked once.
+void stale_aggregates(model::change_list const& changes, std::vector<node const*>& stale)
+{
+    node const* last = nullptr;
+    for (auto& c : changes)
+    {
+        node const* from[2] = { nullptr, nullptr };
+        switch (c.kind)
+        {
+        case model::change::insert:
+        case model::change::remove:
+            from[0] = c.parent;
+            break;
+        case model::change::move:
+            from[0] = c.parent;
+            from[1] = c.target;
+            break;
+        case model::change::expand:
+            from[0] = c.target;
+            break;
+        case model::change::rename:
+            break;
+        }
+
+        for (auto n : from)
+        {
+            if (n == nullptr || n == last) continue;
+            last = n;
+
+            for (; n != nullptr; n = n->parent)
+            {
+                for (uint32_t column : { items_column, total_column })
+                    if (auto cell = cells.find(ui::widget_id(n->id, column)))
+                        cell->generation = uint32_t(-1);
+                stale.push_back(n);
+            }
+        }
+    }
+}
+
+// Drops the expander state and cell text of removed nodes and their
+// descendants, which are still readable while observers run.  Ids are
+// never reused, so this frees the entries early and ends
+// animate_expander on removed nodes.
+void forget_removed(model::change_list const& changes, std::vector<node const*>& stack)
+{
+    for (auto& c : changes)
+    {
+        if (c.kind != model::change::remove) continue;
+
+        for (auto it = c.first;; ++it)
+        {
+            stack.push_back(&*it);
+            if (it == c.last) break;
+        }
+
+        while (!stack.empty())
+        {
+            auto n = stack.back();
+            stack.pop_back();
+
+            expanders.remove(ui::widget_id(n->id));
+            for (uint32_t column = 1; column <= total_column; column++)
+                cells.remove(ui::widget_id(n->id, column));
+            for (auto& child : n->children) stack.push_back(&child);
+        }
+    }
+}
+
+// Patches the tree view after model edits.  Only edits that touch visible
+// rows cost a relayout; renames just a repaint of their row.  The selection follows a
+// single expand or collapse and is dropped by any other change in row order.
+void on_model_change(tree_window& win, model::change_list const& changes)
+{
+    auto& view = win.tv;
+    bool stale = win.layout_changed;
+    size_t relayouts = 0;
+    node const* expanded = nullptr;
+
+    for (auto& c : changes)
+    {
+        switch (c.kind)
+        {
+        case model::change::rename:
+            if (!c.target->is_visible()) break;
+
+            // A sort may move the row among its siblings.
+            if (sorting.active())
+            {
+                win.invalidate_layout();
+                relayouts++;
+            }
+            else
+            {
+                repaint_row(win, *c.target);
+            }
+            break;
+
+        case model::change::expand:
+            if (c.target->is_visible())
+            {
+                win.invalidate_layout();
+                expanded = c.target;
+                relayouts++;
+            }
+            break;
+
+        case model::change::remove:
+            view.hovered = nullptr;
+            // fall through
+        case model::change::insert:
+        case model::change::move:
+            if ((c.parent->is_expanded() && c.parent->is_visible()) ||
+                (c.kind == model::change::move &&
+                    c.target->is_expanded() && c.target->is_visible()))
+            {
+                win.invalidate_layout();
+                relayouts++;
+            }
+            break;
+        }
+    }
+
+    if (relayouts == 1 && expanded != nullptr && !stale)
+        shift_selection(view, *expanded);
+    else if (relayouts > 0)
+        view.selected.clear();
+}
+
+// 't' is the viewport; the content is drawn scrolled by the view's offset.
+// Layout is only redone when the tree or the width changed, and only the
+// rows in the strip the scroll surface exposes are painted.
+target draw_tree_view(target& t, tree_window& win)
+{
+    auto& view = win.tv;
+    win.steady = !win.layout_changed && view.layout.valid(t.width()) &&
+        t.left == view.viewport.left && t.top == view.viewport.top &&
+        t.right == view.viewport.right && t.bottom == view.viewport.bottom &&
+        view.scroll.offset() == win.painted_offset;
+    view.viewport = t;
+    win.painted_offset = view.scroll.offset();
+
+    if (win.layout_changed)
+    {
+        view.layout.invalidate();
+        win.layout_changed = false;
+    }
+
+    // A new width only moves the right edges of the rows; the tree is
+    // walked again only when rows changed.
+    if (!view.layout.valid(t.width()))
+    {
+        if (view.layout.valid(view.layout.width())) view.layout.resize(t.width());
+        else arrange_tree_view(view, t.width());
+        view.surface.invalidate();
+    }
+
+    view.scroll.set_extent(view.layout.height(), t.height());
+
+    // Rows painted coarse stay cached in the scroll surface, so the whole
+    // viewport is repainted when full detail returns.
+    auto was = view.detail.level();
+    auto level = view.detail.update(view.scroll.offset(), t.width(), t.height());
+    if (was == ui::coarse_detail && level == ui::full_detail)
+        win.content_changed = true;
+    if (level == ui::coarse_detail && !win.restoring_detail)
+        restore_detail(win);
+
+    if (win.content_changed)
+    {
+        view.surface.invalidate();
+        win.content_changed = false;
+    }
+
+    view.surface.render(t, view.scroll.offset(), [&](target& content)
+    {
+        fill(content, { 1.0, 1.0, 1.0, 1.0 });
+
+        auto& dirty = view.surface.dirty();
+        auto top = dirty.top + view.scroll.offset();
+        auto bottom = dirty.bottom + view.scroll.offset();
+
+        auto rows = view.layout.rows_in(top, bottom);
+
+        auto first = (size_t)(rows.first - view.layout.begin());
+        auto last = (size_t)(rows.second - view.layout.begin());
+        view.selected.for_each_in(first, last, [&](size_t begin, size_t end)
+        {
+            rectangle band(0, view.layout.at(begin).bounds.top,
+                view.layout.width(), view.layout.at(end - 1).bounds.bottom);
+            fill(content, translate(band, content.left, content.top),
+                { 0.8, 0.9, 1, 1 });
+        });
+
+        for (auto it = rows.first; it != rows.second; it++)
+        {
+            if (level == ui::coarse_detail)
+                sketch_row(content, view.columns, *it, it->node == view.hovered);
+            else
+                paint_row(content, view.columns, *it, it->node == view.hovered);
+        }
+
+        auto& tree = view.columns.at(0);
+        auto tree_right = tree.left + tree.width;
+        view.layout.boxes_in(top, bottom, [&](tree_layout::row const& r)
+        {
+            auto box = r.children;
+            box.right = (std::min)(box.right, tree_right);
+            draw(content, translate(box, content.left, content.top),
+                { 0.8, 0.8, 1, 1 });
+        });
+
+        for (size_t c = 0; c < view.columns.size(); c++)
+        {
+            auto& column = view.columns.at(c);
+            auto x = content.left + column.left + column.width;
+            draw(content, line(point(x, content.top + top), point(x, content.top + bottom)),
+                { 0.9, 0.9, 0.9, 1 });
+        }
+    });
+
+    if (!empty(t))
+        win.painted_percent = (int)(100 * view.surface.dirty().height() / t.height());
+
+    win.selected_count = view.selected.count();
+
+    return t;
+}
+
+point to_content(tree_view const& view, point const& p)
+{
+    return point(
+        p.x - view.viewport.left,
+        p.y - view.viewport.top + view.scroll.offset());
+}
+
+// Row under a point in window coordinates, from the last layout.
+tree_layout::iterator hit_test(tree_view const& view, point const& p)
+{
+    if (!contains(view.viewport, p)) return view.layout.end();
+    return view.layout.hit(to_content(view, p));
+}
+
+// "gui /profile <file>": where the trace goes.
+std::wstring profile_path;
+
+void write_profile()
+{
+    std::ofstream out{ std::filesystem::path(profile_path) };
+    diagnostics::zone_registry::instance().write(out);
+}
+
+// "gui /detail ...": when windows draw their rows as placeholders.
+ui::detail_policy row_detail;
+
+// A root over 'count' nodes in groups of a hundred, built one push_back at
+// a time the way the demo tree used to be.
+node build_by_push_back(size_t count)
+{
+    node root(L"root");
+    root.expanded = true;
+    for (size_t i = 0; i < count; i += 100)
+    {
+        root.children.push_back(node(L"group " + std::to_wstring(i / 100)));
+        auto& group = root.children.back();
+        group.parent = &root;
+
+        for (size_t j = i; j < (std::min)(count, i + 100); j++)
+        {
+            group.children.push_back(node(L"node " + std::to_wstring(j)));
+            group.children.back().parent = &group;
+        }
+    }
+    return root;
+}
+
+// Labels of the tree drawn into a bitmap in memory through the glyph
+// atlas, the path for drawing without Direct2D: once with an atlas of the
+// usual size, once with one too small to hold some labels.
+void benchmark_atlas(std::ostream& out)
+{
+    text_resources resources;
+    text::dwrite_source source(resources.factory, resources.glyphs);
+
+    const size_t labels = 100000;
+    drawing::bitmap target(300, 400);
+    std::wstring label;
+
+    for (int size : { 1024, 128 })
+    {
+        text::glyph_atlas atlas(size);
+        text::atlas_text writer(source, atlas);
+
+        for (size_t i = 0; i < labels; i++)
+        {
+            label = L"granchild " + std::to_wstring(i % 1000) + L" of " + std::to_wstring(i % 37);
+            auto top = (distance)(i % 20 * 20);
+            writer.write_label(target, label, rectangle(0, top, (distance)(i % 300), top + 20));
+        }
+
+        char line[32];
+        snprintf(line, sizeof(line), "%4d px atlas: ", size);
+        out << line;
+        writer.write_statistics(out);
+    }
+}
+
+// Times the batch kernels of rects.h against the same work done one
+// rectangle at a time, over 1M row rectangles: clipping, hit testing,
+// finding the row under a point, bounds and transforming.
+void benchmark_rects(std::ostream& out)
+{
+    typedef std::chrono::steady_clock clock;
+    typedef std::chrono::duration<double, std::nano> ns;
+
+    const size_t count = 1000000;
+    const int times = 20;
+
+    std::vector<rectangle> rects;
+    drawing::rect_array batch;
+    rects.reserve(count);
+    batch.reserve(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        auto top = (distance)(i % 1000 * 20);
+        rectangle r((distance)(i % 7 * 16), top, (distance)(300 + i % 300), top + 20);
+        rects.push_back(r);
+        batch.push_back(r);
+    }
+
+    rectangle clip(50, 0, 400, 10000);
+    point p(320, 19990);
+    std::vector<uint8_t> hits(count);
+
+    drawing::matrix3x2 m;
+    m._11 = 1; m._12 = 0;
+    m._21 = 0; m._22 = 1;
+    m._31 = 0.5f; m._32 = -0.5f;
+
+    size_t found = 0;
+    char line[128];
+
+    auto time = [&](std::function<void()> const& f)
+    {
+        auto start = clock::now();
+        for (int t = 0; t < times; t++) f();
+        return ns(clock::now() - start).count() / times / count;
+    };
+
+    auto compare = [&](char const* what, std::function<void()> const& one, std::function<void()> const& many)
+    {
+        auto single = time(one);
+        auto batched = time(many);
+        snprintf(line, sizeof(line), "%-16s %7.3f ns per rect, batched %7.3f ns (%4.1fx)\n",
+            what, single, batched, single / batched);
+        out << line;
+    };
+
+    compare("intersect", [&]()
+    {
+        for (auto& r : rects)
+        {
+            r.left = (std::max)(r.left, clip.left);
+            r.top = (std::max)(r.top, clip.top);
+            r.right = (std::max)((std::min)(r.right, clip.right), r.left);
+            r.bottom = (std::max)((std::min)(r.bottom, clip.bottom), r.top);
+        }
+    }, [&]() { drawing::intersect(batch, clip); });
+
+    compare("contains", [&]()
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            hits[i] = contains(rects[i], p) ? 1 : 0;
+            found += hits[i];
+        }
+    }, [&]() { found += drawing::contains(batch, p, hits.data()); });
+
+    compare("find containing", [&]()
+    {
+        size_t i = 0;
+        while (i < count && !contains(rects[i], p)) i++;
+        found += i;
+    }, [&]() { found += drawing::find_containing(batch, 0, count, p); });
 
-text::ellipses dots(tf, text_format);
+    compare("bounds", [&]()
+    {
+        auto b = rects.front();
+        for (auto& r : rects)
+        {
+            b.left = (std::min)(b.left, r.left);
+            b.top = (std::min)(b.top, r.top);
+            b.right = (std::max)(b.right, r.right);
+            b.bottom = (std::max)(b.bottom, r.bottom);
+        }
+        found += (size_t)b.bottom;
+    }, [&]() { found += (size_t)drawing::bounds(batch).bottom; });
 
-point mouse;
-boost::optional<point> click;
-std::list<std::function<void()> > timers;
+    compare("transform", [&]()
+    {
+        for (auto& r : rects)
+        {
+            auto x1 = r.left * m._11, x2 = r.right * m._11;
+            auto x3 = r.top * m._21, x4 = r.bottom * m._21;
+            auto y1 = r.left * m._12, y2 = r.right * m._12;
+            auto y3 = r.top * m._22, y4 = r.bottom * m._22;
+
+            r = rectangle(
+                (std::min)(x1, x2) + (std::min)(x3, x4) + m._31,
+                (std::min)(y1, y2) + (std::min)(y3, y4) + m._32,
+                (std::max)(x1, x2) + (std::max)(x3, x4) + m._31,
+                (std::max)(y1, y2) + (std::max)(y3, y4) + m._32);
+        }
+    }, [&]() { drawing::transform_rects(m, batch); });
 
-void animate(boost::asio::deadline_timer& timer, std::function<bool()> f)
+    out << "(" << found << " hits)\n";
+}
+
+// Times the shared tree with 1, 2 and 4 writer threads making random edits
+// as fast as they can: versions published per second, and how long a
+// reader takes to walk the latest version, as a frame mirroring it would,
+// while they write.
+void benchmark_shared_tree(std::ostream& out)
 {
-    std::function<void(const boost::system::error_code&)> timer_func;
-    
-    auto ui_func = [f, &timer]()
+    typedef std::chrono::steady_clock clock;
+    typedef std::chrono::duration<double, std::milli> ms;
+
+    const auto duration = std::chrono::milliseconds(500);
+    std::vector<model::frozen_node const*> stack;
+    char line[128];
+
+    for (unsigned writers : { 1u, 2u, 4u })
     {
-        if (f())
+        model::shared_tree tree(L"feed");
+        for (uint32_t i = 0; i < 20000; i++) random_edit(tree, i);
+
+        std::atomic<bool> stopping(false);
+        std::vector<std::thread> threads;
+        auto before = tree.versions();
+        auto start = clock::now();
+
+        for (unsigned i = 0; i < writers; i++)
         {
-            animate(timer, f);
+            threads.emplace_back([&tree, &stopping, i]()
+            {
+                std::mt19937 random(i);
+                while (!stopping) random_edit(tree, random());
+            });
         }
-    };
-    timer_func = [f, ui_func](const boost::system::error_code& error)
+
+        size_t frames = 0;
+        size_t nodes = 0;
+        double total = 0;
+        double worst = 0;
+
+        while (clock::now() - start < duration)
+        {
+            auto frame = clock::now();
+            nodes = 0;
+            {
+                model::epoch_domain::guard g(tree.epochs());
+                stack.assign(1, tree.root());
+                while (!stack.empty())
+                {
+                    auto n = stack.back();
+                    stack.pop_back();
+                    nodes++;
+                    stack.insert(stack.end(), n->children.begin(), n->children.end());
+                }
+            }
+
+            auto took = ms(clock::now() - frame).count();
+            total += took;
+            worst = (std::max)(worst, took);
+            frames++;
+        }
+
+        stopping = true;
+        for (auto& t : threads) t.join();
+
+        auto seconds = ms(clock::now() - start).count() / 1000;
+        snprintf(line, sizeof(line),
+            "%u writers: %9.0f versions/s, walk %7.3f ms (worst %7.3f) over %zu nodes\n",
+            writers, (tree.versions() - before) / seconds, total / frames, worst, nodes);
+        out << line;
+    }
+}
+
+// Times selection edits over 10M visible rows: the whole range, a
+// shift-click, ctrl-clicks until there are 100K intervals, ctrl-clicks at
+// random rows among them, and then lookups, painting bands and rows
+// appearing and disappearing above them.
+void benchmark_selection(std::ostream& out)
+{
+    typedef std::chrono::steady_clock clock;
+    typedef std::chrono::duration<double, std::micro> us;
+
+    const size_t rows = 10000000;
+    ui::selection s;
+    char line[128];
+
+    auto report = [&](char const* what, size_t times, clock::time_point start)
     {
-        if (error) return;
-        w.invoke_async(ui_func);
+        snprintf(line, sizeof(line), "%-28s %8zu x %9.3f us, %6zu ranges\n",
+            what, times, us(clock::now() - start).count() / times, s.ranges());
+        out << line;
     };
-    timer.expires_from_now(boost::posix_time::milliseconds(50));
-    timer.async_wait(timer_func);
+
+    auto start = clock::now();
+    s.select_all(rows);
+    report("select all", 1, start);
+
+    s.select(5);
+    start = clock::now();
+    s.extend(rows - 10);
+    report("shift-click", 1, start);
+
+    s.clear();
+    start = clock::now();
+    for (size_t row = 0; row < rows; row += 100) s.toggle(row);
+    report("ctrl-click", rows / 100, start);
+
+    // Toggling in ascending order only ever appends; random rows split,
+    // merge and drop intervals in the middle of the vector.
+    std::mt19937 random(1);
+    start = clock::now();
+    for (int i = 0; i < 10000; i++) s.toggle(random() % rows);
+    report("ctrl-click, random order", 10000, start);
+
+    size_t found = 0;
+    start = clock::now();
+    for (size_t row = 0; row < rows; row += 7) found += s.contains(row);
+    report("contains", rows / 7, start);
+
+    start = clock::now();
+    for (size_t top = 0; top < rows; top += 50)
+        s.for_each_in(top, top + 50, [&](size_t first, size_t last) { found += last - first; });
+    report("visible band", rows / 50, start);
+
+    start = clock::now();
+    for (int i = 0; i < 1000; i++) s.insert_rows(1000, 10);
+    report("insert rows", 1000, start);
+
+    start = clock::now();
+    for (int i = 0; i < 1000; i++) s.remove_rows(1000, 10);
+    report("remove rows", 1000, start);
+
+    out << "(" << found << " rows seen)\n";
 }
 
-auto write_label = [&](target& t, std::wstring const& s, drawing::rectangle const& r)
+// "gui /benchmark <file>": time to the rows of the first frame, laid out,
+// for trees of growing size built by push_back and opened from a snapshot
+// of the same tree, with and without verification, then selection edits
+// over 10M rows, the batch rectangle kernels, the shared tree under
+// concurrent writers and the glyph atlas.  Writes one line per size and
+// per edit to <file>.
+void benchmark_startup(std::wstring const& report_path)
 {
-    text::layout l(tf, s, text_format, r.width(), r.height());
-    DWRITE_TRIMMING opts;
-    opts.delimiter = 0;
-    opts.delimiterCount = 0;
-    opts.granularity = DWRITE_TRIMMING_GRANULARITY_CHARACTER;
-    l.ptr->SetTrimming(&opts, dots.ptr);
+    typedef std::chrono::steady_clock clock;
+    typedef std::chrono::duration<double, std::milli> ms;
 
-    drawing::write(t,
-        point(r.left, r.top), l,
-        { 0.0, 0.0, 0.0, 1.0 });
-};
+    std::ofstream out{ std::filesystem::path(report_path) };
+    auto snapshot_path = report_path + L".snapshot";
 
-struct node
-{
-    typedef std::list<node>::iterator iterator;
+    for (size_t count = 1000; count <= 1000000; count *= 10)
+    {
+        auto start = clock::now();
+        double built;
+        {
+            node root = build_by_push_back(count);
+            tree_view view(root);
+            arrange_tree_view(view, 800);
+            built = ms(clock::now() - start).count();
+
+            snapshot::write(snapshot_path, root);
+        }
+
+        double opened[2];
+        for (int verify = 0; verify < 2; verify++)
+        {
+            start = clock::now();
+            snapshot::file f(snapshot_path, verify != 0);
+            model::snapshot_source source(f);
+            node root = source.root();
+            tree_view view(root);
+            arrange_tree_view(view, 800);
+            opened[verify] = ms(clock::now() - start).count();
+        }
 
-    std::wstring name;
-    std::list<node> children;
+        char line[128];
+        snprintf(line, sizeof(line),
+            "%8zu nodes: push_back %9.1f ms, snapshot %7.1f ms, verified %7.1f ms\n",
+            count, built, opened[0], opened[1]);
+        out << line;
+    }
+
+    std::error_code ignored;
+    std::filesystem::remove(std::filesystem::path(snapshot_path), ignored);
+
+    benchmark_selection(out);
+    benchmark_rects(out);
+    benchmark_shared_tree(out);
+    benchmark_atlas(out);
+}
 
-    enum { collapsed, expanding, expanded, collapsing } state;
-    std::chrono::monotonic_clock::time_point start;
-    degrees expander_angle;
+// Closes the "/outline" window, if open; defined with it below.
+void close_outline();
 
-    bool is_expanded()
+// Creates another window onto the document, not shown yet.  Ctrl+N in
+// any window opens one more.
+tree_window& open_window()
+{
+    std::unique_ptr<tree_window> made(new tree_window(document.root()));
+    auto& win = *made;
     {
-        return state == expanded ||
-            state == collapsing;
+        std::lock_guard<std::mutex> hold(windows_lock);
+        windows.push_back(std::move(made));
     }
+    win.w.create(*d2d_factory);
+    win.tv.detail.set_policy(row_detail);
+
+    auto& tv = win.tv;
+    auto& w = win.w;
 
-    void click()
+    w.on_render([&](target& t)
     {
-        switch (state)
+        TRACE_ZONE("on_render");
+        diagnostics::allocation_scope allocations;
+
+        fill(t, { 1.0, 1.0, 1.0, 1.0 });
+
+        if (!first_frame)
         {
-        case collapsed: 
-            state = expanding;
-            start = std::chrono::monotonic_clock::now();
-            w.on_timer([this](){ w.redraw(); return state == expanding; });
-            break;
+            startup.mark("first frame");
+            first_frame = since_startup();
+        }
 
-        case expanded: 
-            state = collapsing;
-            start = std::chrono::monotonic_clock::now();
-            w.on_timer([this](){ w.redraw(); return state == collapsing; });
-            break;
+        // Nothing but the background until the fonts have arrived.
+        if (!fonts) return;
+
+        if (feed_mirror) feed_mirror->sync();
+
+        // The shared caches age by the frames of all windows together.
+        expanders.next_frame();
+        cells.next_frame();
+
+        auto status = to_top(t, 20);
+        draw_status(status, win);
+
+        tv.scroll.update();
+
+        auto area = inside(above(t, status), 5);
+        auto header = from_top(area, 20);
+        tv.header = header;
+        draw_table_header(header, tv.columns);
+
+        auto painting = ui::idle_scheduler::clock::now();
+        draw_tree_view(below(area, 20), win);
+        tv.detail.frame_time(ui::idle_scheduler::clock::now() - painting);
+
+        win.frame_allocations = allocations.count();
+
+        if (++win.frames > tree_window::warm_up_frames && win.steady)
+        {
+            win.steady_frames++;
+            if (win.frame_allocations != 0) win.allocating_frames++;
         }
-    }
 
-    void update()
+        if (!first_full_frame)
+        {
+            startup.mark("first frame with text");
+            first_full_frame = since_startup();
+            report_startup();
+            w.redraw();
+        }
+    });
+    w.on_pointer([&](drawing::point& p)
     {
-        const std::chrono::duration<float> d(0.1);
-        auto now = std::chrono::monotonic_clock::now();
-        std::chrono::duration<float> elapsed = now - start;
-        auto ratio = elapsed.count() / d.count();
+        win.mouse = p;
+
+        // Only the cells of the resized column are fitted again; rows keep
+        // their layout.
+        if (win.resizing != ui::table_columns::none)
+        {
+            tv.columns.resize(win.resizing, win.resize_width + p.x - win.resize_origin);
+            win.invalidate_content();
+            return;
+        }
+
+        if (win.drag_origin && !win.dragging &&
+            std::fabs(p.y - win.drag_origin->y) > drag_threshold)
+        {
+            win.dragging = true;
+        }
+
+        if (win.dragging)
+        {
+            tv.scroll.scroll_to(win.drag_offset - (p.y - win.drag_origin->y));
+            w.redraw();
+            return;
+        }
 
-        switch (state)
+        auto row = hit_test(tv, p);
+        auto hovered = row == tv.layout.end() ? nullptr : row->node;
+        if (hovered != tv.hovered)
+        {
+            tv.hovered = hovered;
+            win.invalidate_content();
+        }
+        else w.redraw();
+    });
+    w.on_mousedown([&](drawing::point& p)
+    {
+        if (contains(tv.header, p))
         {
-        case expanding:
-            if (elapsed > d)
+            auto c = tv.columns.divider_at(p.x - tv.header.left, 3);
+            if (c != ui::table_columns::none)
             {
-                state = expanded;
-                expander_angle = 90;
+                win.resizing = c;
+                win.resize_origin = p.x;
+                win.resize_width = tv.columns.at(c).width;
             }
-            else expander_angle = 90 * ratio;
-            break;
-
-        case collapsing:
-            if (elapsed > d)
+            else if ((c = tv.columns.column_at(p.x - tv.header.left)) != ui::table_columns::none)
             {
-                state = collapsed;
-                expander_angle = 0;
+                // The sort order is shared, so every window follows.
+                sort_by(c);
+                for (auto& tw : windows) tw->tv.selected.clear();
+                invalidate_layout();
             }
-            else expander_angle = 90 - 90 * ratio;
+            return;
         }
-    }
 
-    node(std::wstring const& n) 
-        : name(n), state(collapsed), expander_angle(0) {}
-};
+        win.drag_origin = p;
+        win.drag_offset = tv.scroll.offset();
 
-// Placeholding class for tree structures that have persistent iterators.
-struct tree_view
-{
-    typedef std::deque<node::iterator>::iterator path_iterator;
-    std::deque<node::iterator> path;
-    node root;
+        auto row = hit_test(tv, p);
+        if (row != tv.layout.end() &&
+            contains(row->expander, to_content(tv, p)))
+        {
+            toggle(*row->node);
+            invalidate_content();
+        }
+        else if (row != tv.layout.end())
+        {
+            auto index = (size_t)(row - tv.layout.begin());
 
-    tree_view() : root(L"") {}
-};
+            if (w.control_down()) tv.selected.toggle(index);
+            else if (w.shift_down()) tv.selected.extend(index);
+            else tv.selected.select(index);
 
-target draw_tree(target& t, node& tree);
-target draw_header(target& t, node& tree);
-target draw_node(target& t, node& tree);
+            win.invalidate_content();
+        }
+    });
+    w.on_mouseup([&](drawing::point& p)
+    {
+        win.drag_origin = boost::none;
+        win.dragging = false;
+        win.resizing = ui::table_columns::none;
+    });
+    w.on_keydown([&](unsigned key)
+    {
+        if (key == 'A' && w.control_down())
+        {
+            tv.selected.select_all(tv.layout.size());
+            win.invalidate_content();
+        }
+        else if (key == 'N' && w.control_down())
+        {
+            open_window().w.show();
+        }
+        else if (key == VK_ESCAPE && !tv.selected.empty())
+        {
+            tv.selected.clear();
+            win.invalidate_content();
+        }
+        else if (key == VK_F12 && !profile_path.empty())
+        {
+            write_profile();
+        }
+    });
+    w.on_wheel([&](distance lines)
+    {
+        bool idle = !tv.scroll.animating();
+        tv.scroll.scroll_by(-lines * 3 * 20);
 
-target draw_children(target& t, node::iterator it, node::iterator end)
-{
-    auto remaining = t;
-    for (; it != end; it++)
+        if (idle && tv.scroll.animating())
+            animate_scroll(w, tv.scroll);
+    });
+    w.on_resized([&]()
     {
-        auto child = draw_tree(remaining, *it);
-        remaining = below(remaining, child);
-        if (empty(remaining)) break;
-    }
-    return above(t, remaining);
+        tv.detail.settle();
+        win.invalidate_content();
+    });
+    w.on_close([&]()
+    {
+        win.closed = true;
+        if (&win != windows.front().get()) return;
+
+        for (auto& tw : windows)
+            if (!tw->closed) tw->w.close();
+        close_outline();
+    });
+
+    return win;
 }
 
-target draw_tree(target& t, node& tree)
+// "gui /outline <count>": a window onto a forest of <count> nodes that
+// exists only as an array of parent indices, shown through the generic
+// tree outline without copying it into nodes.
+struct outline_window
 {
-    auto header = draw_header(t, tree);
+    std::vector<uint32_t> parents;
+    ui::parent_index_tree tree;
+    ui::tree_outline<ui::parent_index_tree> outline;
 
-    auto children = to_right(below(t, header), 10);
+    ui::window w;
+    ui::scroller scroll;
+    drawing::scroll_surface surface;
+    rectangle viewport;
+    std::wstring label;
+    bool closed;
 
-    if (tree.is_expanded())
+    // Each node hangs below a random earlier one, so the forest is wide
+    // near the top and a few dozen levels deep.
+    static std::vector<uint32_t> random_parents(uint32_t count)
     {
-        children = draw_children(children, 
-            tree.children.begin(), tree.children.end());
-
-        draw(t, children, { 0.8, 0.8, 1, 1 });
-
-        return children;
+        std::vector<uint32_t> parents(count);
+        std::mt19937 random(1);
+        for (uint32_t i = 0; i < count; i++)
+            parents[i] = i < 10 ? ui::parent_index_tree::none : random() % i;
+        return parents;
     }
-    else return header;
-}
 
-target draw_expander(target& t, node& node)
-{
-    point p1, p2, p3;
-    auto bounds = centered(t, point(8, 8));
+    static void label_of(uint32_t i, std::wstring& text)
+    {
+        text = L"Node ";
+        text += std::to_wstring(i);
+    }
 
-    p1 = bounds.top_left();
-    p2 = bounds.center();
-    p3 = bounds.bottom_left();
+    outline_window(uint32_t count)
+        : parents(random_parents(count)),
+        tree(parents.data(), count, label_of),
+        outline(tree), closed(false)
+    {
+    }
+};
 
-    transform rot(t, D2D1::Matrix3x2F::Rotation(node.expander_angle, center(bounds)));
-    draw(t, line(p1, p2), { 0, 0, 0, 1 });
-    draw(t, line(p2, p3), { 0, 0, 0, 1 });
-    draw(t, line(p3, p1), { 0, 0, 0, 1 });
+std::unique_ptr<outline_window> outline_view;
 
-    return t;
+void close_outline()
+{
+    if (outline_view && !outline_view->closed) outline_view->w.close();
 }
 
-target draw_header(target& t, node& node)
+void draw_outline(target& t, outline_window& ow)
 {
-    auto label = draw_node(to_right(t, 15), node);
-    auto header = from_left(t, 15);
-    header.bottom = label.bottom;
-    auto expander = from_left(header, 10);
+    auto& layout = ow.outline.layout();
+    ow.viewport = t;
 
-    if (click && contains(expander, click.get()))
+    if (!layout.valid(t.width()))
     {
-        node.click();
-        click = boost::none;
+        ow.outline.arrange(t.width());
+        ow.surface.invalidate();
     }
-    node.update();
+    ow.scroll.set_extent(layout.height(), t.height());
 
-    draw_expander(expander, node);
-    return header;
-}
+    ow.surface.render(t, ow.scroll.offset(), [&](target& content)
+    {
+        fill(content, { 1.0, 1.0, 1.0, 1.0 });
 
-target draw_node(target& t, node& node)
-{
-    auto used = from_top(t, 20);
-    if (contains(used, mouse)) fill(used, { 0.8, 1, 0.8, 1 });
-    write_label(t, node.name, centered(used, point(used.width(), 15)));
-    return used;
-}
+        auto& dirty = ow.surface.dirty();
+        auto top = dirty.top + ow.scroll.offset();
+        auto bottom = dirty.bottom + ow.scroll.offset();
 
-target draw_status(target& t)
-{
-    std::wstring status_text =
-        L"Pointer: " +
-        std::to_wstring((int)mouse.x) + L", " +
-        std::to_wstring((int)mouse.y);
+        auto rows = layout.rows_in(top, bottom);
+        for (auto it = rows.first; it != rows.second; it++)
+        {
+            ow.tree.label(it->node, ow.label);
+            paint_tree_row(content, *it, it->label.right, ow.label,
+                ow.tree.expandable(it->node), it->expanded ? 90.0f : 0.0f, false);
+        }
 
-    draw(t, t.top_edge(), { 0, 0, 0, 1 });
-    write_label(t, status_text, centered(t, point(t.width(), 12)));
-    return t;
+        layout.boxes_in(top, bottom, [&](ui::tree_layout<uint32_t>::row const& r)
+        {
+            draw(content, translate(r.children, content.left, content.top),
+                { 0.8, 0.8, 1, 1 });
+        });
+    });
 }
 
-target draw_tree_view_depth(target& t, tree_view& view, tree_view::path_iterator path)
+void open_outline(uint32_t count)
 {
-    auto remaining = t;
-    if (path != view.path.end())
+    outline_view.reset(new outline_window(count));
+    auto& ow = *outline_view;
+    ow.w.create(*d2d_factory);
+
+    ow.w.on_render([&](target& t)
     {
-        auto used = draw_tree_view_depth(to_right(t, 10), view, path + 1);
-        remaining = below(remaining, used);
-    }
+        fill(t, { 1.0, 1.0, 1.0, 1.0 });
+        if (!fonts) return;
 
-    draw_children(below(t, remaining), *path, (*(path - 1))->children.end());
+        auto status = to_top(t, 20);
+        drawing::frame_text status_text(*t.arena, 96);
+        status_text << L"Nodes: " << ow.tree.size() <<
+            L"  Rows: " << ow.outline.layout().size() <<
+            L"  Child index: " << (long long)(ow.tree.memory() / 1024) << L" KB";
+        draw(status, status.top_edge(), { 0, 0, 0, 1 });
+        write_label(status, status_text.view(), centered(status, point(status.width(), 12)));
 
-    return t;
-}
+        ow.scroll.update();
+        draw_outline(inside(above(t, status), 5), ow);
+    });
+    ow.w.on_mousedown([&](drawing::point& p)
+    {
+        if (!contains(ow.viewport, p)) return;
 
-target draw_tree_view(target& t, tree_view& view)
-{
-    return draw_tree_view_depth(t, view, view.path.begin() + 1);
-}
+        auto row = ow.outline.layout().hit(point(
+            p.x - ow.viewport.left, p.y - ow.viewport.top + ow.scroll.offset()));
+        if (row == ow.outline.layout().end()) return;
 
-struct mynode
-{
-    std::wstring name;
-};
-
-template <typename Container>
-struct tree
-{
-    typedef Container container;
-    typedef typename Container::value_type value_type;
-
-    value_type value;
-    container children;
-};
+        ow.outline.toggle(row->node);
+        ow.w.redraw();
+    });
+    ow.w.on_wheel([&](distance lines)
+    {
+        bool idle = !ow.scroll.animating();
+        ow.scroll.scroll_by(-lines * 3 * 20);
+
+        if (idle && ow.scroll.animating())
+            animate_scroll(ow.w, ow.scroll);
+    });
+    ow.w.on_close([&]()
+    {
+        ow.closed = true;
+    });
 
-template <typename T>
-struct vector_tree : public tree<std::vector<T> > {};
-
-typedef vector_tree<mynode> node_tree;
+    ow.w.show();
+}
 
 int APIENTRY _tWinMain(_In_ HINSTANCE hInstance,
                      _In_opt_ HINSTANCE hPrevInstance,
@@ -282,62 +2052,241 @@ int APIENTRY _tWinMain(_In_ HINSTANCE hInstance,
                      _In_ int       nCmdShow)
 {
 	UNREFERENCED_PARAMETER(hPrevInstance);
-	UNREFERENCED_PARAMETER(lpCmdLine);
 
-    node_tree nt;
-    nt.value.name = L"root";
+    boost::asio::io_service::work work(io);
+    std::thread io_thread([&]()
+    {
+        diagnostics::name_thread("io");
+        io.run();
+    });
+    diagnostics::name_thread("ui");
+
+    // "gui <file>" opens a snapshot, or streams in a .json or .xml
+    // document; "gui /save <file>" writes the demo tree to a snapshot.
+    // "gui /record <file>" saves the session's input as a trace on exit;
+    // "gui /replay <file>" plays one back and writes frame and input
+    // latency histograms to <file>.txt; in builds with
+    // GUI_COUNT_ALLOCATIONS it exits with 1 if a steady-state frame
+    // allocated.  "gui /feed" shows a tree that
+    // background threads keep editing.  "gui /profile <file>" records
+    // trace zones (in builds with GUI_TRACE_ZONES) and writes them to
+    // <file> as Chrome trace JSON on exit, or whenever F12 is pressed.
+    // "gui /benchmark <file>" times the first view of push_back-built
+    // trees against snapshots of them, selection edits over 10M rows and
+    // labels drawn through the glyph atlas, writes the results to <file>
+    // and exits.  "gui /detail <scroll> <resize> [<settle>]" sets the speeds, in
+    // pixels per second, above which rows are drawn as placeholders and
+    // the milliseconds until full detail returns; "gui /detail off" always
+    // draws full detail.  "gui /outline <count>" also opens a window onto
+    // <count> nodes held as parent indices.
+    std::wstring cmdline(lpCmdLine);
+    std::wstring save_path;
+    std::wstring record_path;
+    std::wstring replay_path;
+    std::wstring benchmark_path;
+    std::unique_ptr<snapshot::file> snapshot_file;
+    std::unique_ptr<model::snapshot_source> snapshot_nodes;
+    std::filesystem::path stream_path;
+    bool feed = false;
+    bool replay_failed = false;
+    uint32_t outline_count = 0;
 
-    ui::depth_first_tree_view<node_tree> tview(nt);
-    for (auto& n : tview)
+    if (cmdline.compare(0, 6, L"/save ") == 0)
+        save_path = cmdline.substr(6);
+    else if (cmdline.compare(0, 8, L"/record ") == 0)
+        record_path = cmdline.substr(8);
+    else if (cmdline.compare(0, 8, L"/replay ") == 0)
+        replay_path = cmdline.substr(8);
+    else if (cmdline == L"/feed")
+        feed = true;
+    else if (cmdline.compare(0, 9, L"/profile ") == 0)
+        profile_path = cmdline.substr(9);
+    else if (cmdline.compare(0, 11, L"/benchmark ") == 0)
+        benchmark_path = cmdline.substr(11);
+    else if (cmdline.compare(0, 9, L"/outline ") == 0)
+        outline_count = (uint32_t)std::wcstoul(cmdline.c_str() + 9, nullptr, 10);
+    else if (cmdline == L"/detail off")
+        row_detail.enabled = false;
+    else if (cmdline.compare(0, 8, L"/detail ") == 0)
     {
-        std::wcout << n.name << std::endl;
+        std::wistringstream in(cmdline.substr(8));
+        long long settle = row_detail.settle.count();
+        in >> row_detail.scroll_speed >> row_detail.resize_speed >> settle;
+        row_detail.settle = std::chrono::milliseconds(settle);
+    }
+    else if (!cmdline.empty())
+    {
+        std::filesystem::path path(cmdline);
+        if (path.extension() == L".json" || path.extension() == L".xml")
+            stream_path = path;
+        else
+        {
+            try
+            {
+                snapshot_file.reset(new snapshot::file(cmdline));
+            }
+            catch (snapshot::snapshot_exception const& e)
+            {
+                failed_to_open(cmdline, e.what());
+            }
+        }
     }
 
-    boost::asio::io_service::work work(io);
-    std::thread io_thread([&](){ io.run(); });
+    if (!benchmark_path.empty())
+    {
+        benchmark_startup(benchmark_path);
+        io.stop();
+        io_thread.join();
+        return 0;
+    }
 
-    node root(L"root");
+    if (!profile_path.empty())
+        diagnostics::zone_registry::instance().enable(true);
 
-    root.children.push_back(node(L"child1"));
-    auto child = root.children.rbegin();
-    child->children.push_back(node(L"granchild1 of 1"));
-    child->children.push_back(node(L"granchild2 of 1"));
-    
-    root.children.push_back(node(L"child2"));
-    child = root.children.rbegin();
-    child->children.push_back(node(L"granchild1 of 2"));
-    child->children.push_back(node(L"granchild2 of 2"));
-    child->children.push_back(node(L"granchild3 of 2"));
-
-    root.children.push_back(node(L"child3"));
-    child = root.children.rbegin();
-    child->children.push_back(node(L"granchild1 of 3"));
+    // Startup: the window is created and shown as soon as it can be.  The
+    // fonts are made on the io thread meanwhile, and the first frames are
+    // drawn without text until they arrive; a streamed document keeps
+    // loading after the window is up.
+    {
+        diagnostics::startup_timeline::scope phase(startup, "d2d factory");
+        d2d_factory.reset(new drawing::factory());
+    }
+    {
+        diagnostics::startup_timeline::scope phase(startup, "window");
+        open_window();
+    }
+    load_fonts();
 
-    tree_view tv;
-    tv.root.children.push_back(root);
-    tv.path.push_back(tv.root.children.begin());
+    auto& w = main_window();
+    descendants.initialize(document);
+    total_sizes.initialize(document);
 
-    w.on_render([&](target& t)
+    document.subscribe([&](model::change_list const& changes)
     {
-        fill(t, { 1.0, 1.0, 1.0, 1.0 });
+        descendants.update(changes);
+        total_sizes.update(changes);
+        sorting.update(changes);
+        key_rows(changes);
 
-        auto status = to_top(t, 20);
-        draw_status(status);
+        std::vector<node const*> walk;
+        forget_removed(changes, walk);
 
-        //draw_tree(clip(inside(above(t, status), 5)), root);
-        draw_tree_view(clip(inside(above(t, status), 5)), tv);
+        std::vector<node const*> stale;
+        stale_aggregates(changes, stale);
+
+        for (auto& tw : windows)
+        {
+            on_model_change(*tw, changes);
+
+            // Windows laying out again repaint everything anyway.
+            if (tw->layout_changed) continue;
+            for (auto n : stale)
+                if (n->is_visible()) repaint_row(*tw, *n);
+        }
     });
-    w.on_pointer([&](drawing::point& p)
+
+    // The window goes up empty; the document below fills it in through
+    // the subscription above, on the next frames.
+    if (!record_path.empty()) w.record();
+
     {
-        mouse = p;
-        w.redraw();
-    });
-    w.on_mousedown([&](drawing::point& p)
+        diagnostics::startup_timeline::scope phase(startup, "show");
+        w.show();
+    }
+
+    node::iterator root;
+    auto loading = diagnostics::startup_timeline::clock::now();
+
+    if (snapshot_file)
     {
-        click = p;
-        w.redraw();
-    });
-    w.show();
+        snapshot_nodes.reset(new model::snapshot_source(*snapshot_file));
+        root = document.append(document.root(), snapshot_nodes->root());
+    }
+    else if (!open_error.empty())
+    {
+        root = document.append(document.root(), node(std::filesystem::path(cmdline).filename().wstring()));
+    }
+    else if (!stream_path.empty())
+    {
+        try
+        {
+            streaming.loader.reset(new model::document_loader(stream_path));
+            streaming.values.reset(new model::document_source(stream_path));
+        }
+        catch (model::load_exception const& e)
+        {
+            failed_to_open(stream_path.wstring(), e.what());
+        }
+        catch (std::filesystem::filesystem_error const& e)
+        {
+            failed_to_open(stream_path.wstring(), e.what());
+        }
+
+        // Without both, the document stays empty and is not streamed.
+        if (!open_error.empty()) streaming.loader.reset();
+
+        root = document.append(document.root(), node(stream_path.filename().wstring()));
+        if (streaming.loader) document.set_expanded(*root, true);
+    }
+    else if (feed)
+    {
+        feed_tree.reset(new model::shared_tree(L"feed"));
+        root = document.append(document.root(), node(L"feed"));
+        document.set_expanded(*root, true);
+        feed_mirror.reset(new model::tree_mirror(*feed_tree, document, *root));
+    }
+    else
+    {
+        model::tree_model::batch batch(document);
+
+        root = document.append(document.root(), node(L"root"));
+
+        auto child = document.append(*root, node(L"child1"));
+        document.append(*child, node(L"granchild1 of 1"));
+        document.append(*child, node(L"granchild2 of 1"));
+        
+        child = document.append(*root, node(L"child2"));
+        document.append(*child, node(L"granchild1 of 2"));
+        document.append(*child, node(L"granchild2 of 2"));
+        document.append(*child, node(L"granchild3 of 2"));
+
+        child = document.append(*root, node(L"child3"));
+        document.append(*child, node(L"granchild1 of 3"));
+
+        fill_columns(*root, std::time(nullptr));
+    }
+
+    startup.record("document", loading, diagnostics::startup_timeline::clock::now());
+
+    if (!save_path.empty())
+        snapshot::write(save_path, *root);
+
+    if (streaming.loader) stream_document(*root);
+
+    if (outline_count > 0) open_outline(outline_count);
+
+    std::atomic<bool> stopping(false);
+    std::vector<std::thread> producers;
+    if (feed_tree)
+    {
+        for (unsigned i = 0; i < 2; i++)
+            producers.emplace_back([&stopping, i]() { produce(*feed_tree, stopping, i); });
+    }
+
+    if (!replay_path.empty())
+    {
+        auto report = w.replay(ui::input_trace::load(std::filesystem::path(replay_path)));
+        if (diagnostics::counting_allocations())
+        {
+            report.steady_frames = windows.front()->steady_frames;
+            report.allocating_frames = windows.front()->allocating_frames;
+        }
+        replay_failed = report.failed();
+
+        std::ofstream out(std::filesystem::path(replay_path + L".txt"));
+        report.write(out);
+        w.close();
+    }
 
  	// TODO: Place code here.
 	MSG msg;
@@ -353,10 +2302,19 @@ int APIENTRY _tWinMain(_In_ HINSTANCE hInstance,
 			TranslateMessage(&msg);
 			DispatchMessage(&msg);
 		}
+        free_closed_windows();
 	}
 
+    if (!record_path.empty())
+        w.recorded()->save(std::filesystem::path(record_path));
+
+    if (!profile_path.empty()) write_profile();
+
+    stopping = true;
+    for (auto& p : producers) p.join();
+
     io.stop();
     io_thread.join();
 
-	return (int) msg.wParam;
+	return replay_failed ? 1 : (int) msg.wParam;
 }
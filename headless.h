@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <list>
+#include "clock.h"
+#include "geometry.h"
+#include "idle.h"
+#include "trace.h"
+
+namespace ui
+{
+    // Replays traces without a window, on any platform.  Recorded input
+    // goes to callbacks of the same shape as ui::window's, the frame clock
+    // follows the recorded timeline, and idle work runs after each frame in
+    // what is left of the frame budget and on recorded idle timers, as it
+    // does in a window.  Release gates run portable view code (layout,
+    // selection, scrolling, idle jobs) through it on machines with no
+    // display; painting is whatever on_frame does.
+    class headless_driver
+    {
+        typedef std::list<std::function<bool()> > timer_list;
+
+        std::function<void(drawing::point&)> _onpointer;
+        std::function<void(drawing::point&)> _onmousedown;
+        std::function<void(drawing::point&)> _onmouseup;
+        std::function<void(drawing::distance)> _onwheel;
+        std::function<void(unsigned)> _onkeydown;
+        std::function<void(drawing::distance, drawing::distance)> _onresize;
+        std::function<void()> _onresized;
+        std::function<void()> _onframe;
+        timer_list _ontimer;
+
+        idle_scheduler _idle;
+        idle_scheduler::clock::duration _frame_budget;
+
+        uint8_t _modifiers;
+        drawing::distance _width;
+        drawing::distance _height;
+        size_t _frames;
+
+        // Within a recorded border drag, and whether it changed the size.
+        bool _sizing;
+        bool _resized;
+
+        headless_driver(headless_driver const&);
+        headless_driver& operator=(headless_driver const&);
+
+        struct timer_helper
+        {
+            template <typename F>
+            bool operator()(F f) const { return !f(); }
+        };
+
+    public:
+        // Wheel deltas are recorded raw; this many make one line, as on
+        // Windows.
+        static const int wheel_delta = 120;
+
+        typedef timer_list::iterator timer_id;
+
+        headless_driver()
+            : _frame_budget(std::chrono::milliseconds(16)),
+            _modifiers(0), _width(0), _height(0), _frames(0),
+            _sizing(false), _resized(false)
+        {
+        }
+
+        void on_pointer(std::function<void(drawing::point&)> f) { _onpointer = f; }
+        void on_mousedown(std::function<void(drawing::point&)> f) { _onmousedown = f; }
+        void on_mouseup(std::function<void(drawing::point&)> f) { _onmouseup = f; }
+
+        // Called with the number of lines the wheel turned, positive when
+        // turned away from the user.
+        void on_wheel(std::function<void(drawing::distance)> f) { _onwheel = f; }
+
+        void on_keydown(std::function<void(unsigned)> f) { _onkeydown = f; }
+
+        // Called with the new client size.
+        void on_resize(std::function<void(drawing::distance, drawing::distance)> f)
+        {
+            _onresize = f;
+        }
+
+        // Called at the end of a recorded drag of the window border that
+        // changed its size, as ui::window does.
+        void on_resized(std::function<void()> f) { _onresized = f; }
+
+        // True within a recorded border drag once the size has changed.
+        bool live_resizing() const { return _sizing && _resized; }
+
+        // Called for each recorded frame, in place of painting.
+        void on_frame(std::function<void()> f) { _onframe = f; }
+
+        // Runs 'f' on each recorded window timer until it returns false.
+        timer_id on_timer(std::function<bool()> f)
+        {
+            _ontimer.push_front(f);
+            return _ontimer.begin();
+        }
+
+        void off_timer(timer_id id) { _ontimer.erase(id); }
+
+        // Modifier keys recorded with the event being replayed.
+        bool shift_down() const { return (_modifiers & input_event::shift) != 0; }
+        bool control_down() const { return (_modifiers & input_event::control) != 0; }
+
+        drawing::distance width() const { return _width; }
+        drawing::distance height() const { return _height; }
+
+        // Frames replayed so far.
+        size_t frames() const { return _frames; }
+
+        idle_scheduler::task_id post_idle(idle_scheduler::task t,
+            idle_scheduler::priority p = idle_scheduler::normal)
+        {
+            return _idle.post(t, p);
+        }
+
+        void cancel_idle(idle_scheduler::task_id id) { _idle.cancel(id); }
+
+        idle_scheduler const& idle() const { return _idle; }
+
+        void set_frame_budget(idle_scheduler::clock::duration budget)
+        {
+            _frame_budget = budget;
+        }
+
+        replay_report replay(input_trace const& trace)
+        {
+            struct sink
+            {
+                headless_driver& d;
+
+                void modifiers(uint8_t m) { d._modifiers = m; }
+                void elapsed() {}
+
+                void pointer(int32_t x, int32_t y)
+                {
+                    drawing::point p((drawing::distance)x, (drawing::distance)y);
+                    if (d._onpointer) d._onpointer(p);
+                }
+
+                void mousedown(int32_t x, int32_t y)
+                {
+                    drawing::point p((drawing::distance)x, (drawing::distance)y);
+                    if (d._onmousedown) d._onmousedown(p);
+                }
+
+                void mouseup(int32_t x, int32_t y)
+                {
+                    drawing::point p((drawing::distance)x, (drawing::distance)y);
+                    if (d._onmouseup) d._onmouseup(p);
+                }
+
+                void wheel(int32_t delta)
+                {
+                    if (d._onwheel) d._onwheel((drawing::distance)delta / wheel_delta);
+                }
+
+                void keydown(unsigned key)
+                {
+                    if (d._onkeydown) d._onkeydown(key);
+                }
+
+                void resize(int32_t width, int32_t height)
+                {
+                    d._width = (drawing::distance)width;
+                    d._height = (drawing::distance)height;
+                    if (d._sizing) d._resized = true;
+                    if (d._onresize) d._onresize(d._width, d._height);
+                }
+
+                void enter_size_move()
+                {
+                    d._sizing = true;
+                    d._resized = false;
+                }
+
+                void exit_size_move()
+                {
+                    bool resized = d._resized;
+                    d._sizing = d._resized = false;
+                    if (resized && d._onresized) d._onresized();
+                }
+
+                void timer(int32_t which)
+                {
+                    if (which == input_event::idle_timer)
+                    {
+                        d._idle.run(d._frame_budget);
+                        return;
+                    }
+
+                    d._ontimer.erase(std::remove_if(d._ontimer.begin(), d._ontimer.end(),
+                        timer_helper()), d._ontimer.end());
+                }
+
+                void frame()
+                {
+                    auto start = idle_scheduler::clock::now();
+                    if (d._onframe) d._onframe();
+                    d._frames++;
+
+                    auto spent = idle_scheduler::clock::now() - start;
+                    if (!d._idle.empty() && spent < d._frame_budget)
+                        d._idle.run(d._frame_budget - spent);
+                }
+            };
+
+            sink s = { *this };
+            return ui::replay(trace, s);
+        }
+    };
+}
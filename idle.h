@@ -0,0 +1,103 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <list>
+#include "clock.h"
+
+namespace ui
+{
+    // Cooperative scheduler for UI-thread work that can wait: tasks run in
+    // slices in whatever time a frame leaves over, so a long job is spread
+    // over many frames instead of stalling input and painting.  Higher
+    // priority tasks run first; tasks of equal priority run in the order
+    // they were posted.
+    class idle_scheduler
+    {
+    public:
+        typedef frame_clock clock;
+
+        enum priority { low, normal, high };
+
+        // Time a task may use before it has to yield.
+        class slice
+        {
+            clock::time_point _deadline;
+
+        public:
+            slice(clock::time_point deadline) : _deadline(deadline) {}
+
+            bool expired() const { return clock::now() >= _deadline; }
+        };
+
+        // Does some work and returns true if there is more to do.  A task is
+        // called again in the same slice until it finishes or the slice
+        // expires, so it may return after any amount of work.
+        typedef std::function<bool(slice const&)> task;
+
+    private:
+        struct entry
+        {
+            task run;
+            priority level;
+            bool running;
+            bool cancelled;
+        };
+
+        typedef std::list<entry> task_list;
+
+        task_list _tasks;
+        clock::duration _budget;
+        clock::duration _used;
+
+    public:
+        typedef task_list::iterator task_id;
+
+        idle_scheduler() : _budget(0), _used(0) {}
+
+        task_id post(task t, priority p = normal)
+        {
+            auto before = _tasks.begin();
+            while (before != _tasks.end() && before->level >= p) before++;
+
+            entry e = { t, p, false, false };
+            return _tasks.insert(before, e);
+        }
+
+        // Drops a task that has not finished.  A task may cancel itself.
+        void cancel(task_id id)
+        {
+            if (id->running) id->cancelled = true;
+            else _tasks.erase(id);
+        }
+
+        bool empty() const { return _tasks.empty(); }
+        size_t size() const { return _tasks.size(); }
+
+        // Runs tasks until they are done or 'budget' is spent, and returns
+        // true if any remain.
+        bool run(clock::duration budget)
+        {
+            auto start = clock::now();
+            slice s(start + budget);
+
+            auto it = _tasks.begin();
+            while (it != _tasks.end() && !s.expired())
+            {
+                it->running = true;
+                bool more = it->run(s);
+                it->running = false;
+
+                if (!more || it->cancelled) it = _tasks.erase(it);
+            }
+
+            _budget = budget;
+            _used = clock::now() - start;
+            return !_tasks.empty();
+        }
+
+        // Budget given to the last run() and how much of it was used.
+        clock::duration last_budget() const { return _budget; }
+        clock::duration last_used() const { return _used; }
+    };
+}
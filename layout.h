@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "geometry.h"
+#include "rects.h"
+
+namespace ui
+{
+    // Geometry of one visible tree row, in content coordinates: the content
+    // starts at (0, 0) and rows are stacked downwards in display order.
+    // 'Handle' names the node, a pointer or whatever a tree adapter uses.
+    template <typename Handle>
+    struct row_layout
+    {
+        Handle node;
+        size_t parent;
+        drawing::rectangle bounds;
+        drawing::rectangle expander;
+        drawing::rectangle label;
+
+        // Area of the descendant rows, if expanded.
+        bool expanded;
+        drawing::rectangle children;
+    };
+
+    // Result of the layout pass over a tree.  It is rebuilt only after
+    // invalidate() or when the width changes; painting and hit testing just
+    // read it.  The row bounds are also kept one array per edge, so the
+    // searches of painting and hit testing run over packed edges instead
+    // of whole rows.
+    template <typename Handle>
+    class tree_layout
+    {
+    public:
+        typedef row_layout<Handle> row;
+        typedef typename std::vector<row>::const_iterator iterator;
+
+        static const size_t none = size_t(-1);
+
+    private:
+        std::vector<row> _rows;
+        drawing::rect_array _bounds;
+        drawing::distance _width;
+        drawing::distance _height;
+        bool _valid;
+
+    public:
+        tree_layout() : _width(0), _height(0), _valid(false) {}
+
+        void invalidate() { _valid = false; }
+
+        bool valid(drawing::distance width) const
+        {
+            return _valid && _width == width;
+        }
+
+        // Rebuilding: rebuild(), then add() every visible row in display
+        // order, then commit().  Row storage is reused between rebuilds.
+        void rebuild(drawing::distance width)
+        {
+            _rows.clear();
+            _bounds.clear();
+            _width = width;
+            _height = 0;
+        }
+
+        size_t add(row const& r)
+        {
+            _rows.push_back(r);
+            _bounds.push_back(r.bounds);
+            _height = (std::max)(_height, r.bounds.bottom);
+            return _rows.size() - 1;
+        }
+
+        void commit() { _valid = true; }
+
+        // Moves the right edge of every row, its label and its children
+        // area to 'width', for layouts whose rows span the full width.  A
+        // valid layout stays valid, at the new width, without walking the
+        // tree again.
+        void resize(drawing::distance width)
+        {
+            for (auto& r : _rows)
+            {
+                r.bounds.right = width;
+                r.label.right = width;
+                if (r.expanded) r.children.right = width;
+            }
+            std::fill(_bounds.right.begin(), _bounds.right.end(), width);
+            _width = width;
+        }
+
+        row& at(size_t i) { return _rows[i]; }
+        row const& at(size_t i) const { return _rows[i]; }
+
+        size_t size() const { return _rows.size(); }
+
+        // Bytes held by the row storage.
+        size_t memory() const
+        {
+            return _rows.capacity() * sizeof(row) + _bounds.left.capacity() * 4 * sizeof(float);
+        }
+
+        drawing::distance width() const { return _width; }
+        drawing::distance height() const { return _height; }
+
+        iterator begin() const { return _rows.begin(); }
+        iterator end() const { return _rows.end(); }
+
+        // Rows overlapping the band [top, bottom).
+        std::pair<iterator, iterator> rows_in(
+            drawing::distance top, drawing::distance bottom) const
+        {
+            auto& tops = _bounds.top;
+            auto& bottoms = _bounds.bottom;
+
+            auto first = std::partition_point(bottoms.begin(), bottoms.end(),
+                [top](float b) { return b <= top; }) - bottoms.begin();
+            auto last = std::partition_point(tops.begin() + first, tops.end(),
+                [bottom](float t) { return t < bottom; }) - tops.begin();
+            return std::make_pair(_rows.begin() + first, _rows.begin() + last);
+        }
+
+        // Row containing 'p', or end().
+        iterator hit(drawing::point const& p) const
+        {
+            auto rows = rows_in(p.y, p.y + 1);
+            auto first = (size_t)(rows.first - _rows.begin());
+            auto last = (size_t)(rows.second - _rows.begin());
+
+            auto i = drawing::find_containing(_bounds, first, last, p);
+            return i == last ? end() : _rows.begin() + i;
+        }
+
+        // Calls 'f' with every row whose children area overlaps the band
+        // [top, bottom): the ancestors of the first row in the band, then the
+        // expanded rows inside it.
+        template <typename F>
+        void boxes_in(drawing::distance top, drawing::distance bottom, F f) const
+        {
+            auto rows = rows_in(top, bottom);
+            if (rows.first == rows.second) return;
+
+            for (auto p = rows.first->parent; p != none; p = _rows[p].parent)
+                f(_rows[p]);
+
+            for (auto it = rows.first; it != rows.second; it++)
+                if (it->expanded) f(*it);
+        }
+    };
+}
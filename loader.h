@@ -0,0 +1,751 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "model.h"
+
+namespace model
+{
+    class load_exception : public std::exception
+    {
+        char const* _reason;
+
+    public:
+        load_exception(char const* reason) : _reason(reason) {}
+
+        char const* what() const throw() override { return _reason; }
+    };
+
+    // Reads a file through a fixed buffer, keeping track of the offset.
+    class byte_reader
+    {
+        std::ifstream _file;
+        std::vector<char> _buffer;
+        size_t _pos;
+        size_t _end;
+        uint64_t _base;
+
+        bool fill()
+        {
+            _base += _end;
+            _pos = 0;
+            _file.read(_buffer.data(), _buffer.size());
+            _end = (size_t)_file.gcount();
+            return _end > 0;
+        }
+
+    public:
+        byte_reader(std::filesystem::path const& path, size_t buffer = 64 * 1024)
+            : _file(path, std::ios::binary), _buffer(buffer), _pos(0), _end(0), _base(0)
+        {
+            if (!_file) throw load_exception("cannot open document");
+        }
+
+        // The next byte, or -1 at the end of the file.
+        int peek()
+        {
+            if (_pos == _end && !fill()) return -1;
+            return (unsigned char)_buffer[_pos];
+        }
+
+        int get()
+        {
+            auto c = peek();
+            if (c >= 0) _pos++;
+            return c;
+        }
+
+        uint64_t offset() const { return _base + _pos; }
+
+        void seek(uint64_t offset)
+        {
+            _file.clear();
+            _file.seekg(offset);
+            _base = offset;
+            _pos = _end = 0;
+        }
+    };
+
+    // Appends UTF-8 'in' to 'out' as wide characters; malformed bytes are
+    // taken as Latin-1.
+    void append_utf8(std::wstring& out, std::string const& in)
+    {
+        for (size_t i = 0; i < in.size();)
+        {
+            auto c = (unsigned char)in[i];
+            int more = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : 0;
+            uint32_t cp = more == 0 ? c : c & (0x3f >> more);
+
+            bool ok = c < 0x80 || more > 0;
+            for (int k = 1; ok && k <= more; k++)
+            {
+                if (i + k >= in.size() || (in[i + k] & 0xc0) != 0x80) ok = false;
+                else cp = (cp << 6) | (in[i + k] & 0x3f);
+            }
+
+            if (!ok)
+            {
+                out += (wchar_t)c;
+                i++;
+                continue;
+            }
+            i += more + 1;
+
+            if (sizeof(wchar_t) == 2 && cp >= 0x10000)
+            {
+                cp -= 0x10000;
+                out += (wchar_t)(0xd800 + (cp >> 10));
+                out += (wchar_t)(0xdc00 + (cp & 0x3ff));
+            }
+            else out += (wchar_t)cp;
+        }
+    }
+
+    void append_code_point(std::string& out, uint32_t cp)
+    {
+        if (cp < 0x80) out += (char)cp;
+        else if (cp < 0x800)
+        {
+            out += (char)(0xc0 | (cp >> 6));
+            out += (char)(0x80 | (cp & 0x3f));
+        }
+        else if (cp < 0x10000)
+        {
+            out += (char)(0xe0 | (cp >> 12));
+            out += (char)(0x80 | ((cp >> 6) & 0x3f));
+            out += (char)(0x80 | (cp & 0x3f));
+        }
+        else
+        {
+            out += (char)(0xf0 | (cp >> 18));
+            out += (char)(0x80 | ((cp >> 12) & 0x3f));
+            out += (char)(0x80 | ((cp >> 6) & 0x3f));
+            out += (char)(0x80 | (cp & 0x3f));
+        }
+    }
+
+    bool is_space(int c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    // What a document reader reports: a container beginning or ending, or
+    // a leaf whose value starts at 'offset' and is left in the file.
+    struct parse_event
+    {
+        enum kind_type { begin, end, leaf };
+
+        kind_type kind;
+        std::wstring name;
+        uint64_t offset;
+    };
+
+    // A pull parser over a document too large to hold.  Memory use depends
+    // on nesting depth, not on file size.
+    class document_reader
+    {
+    protected:
+        byte_reader _in;
+
+        document_reader(std::filesystem::path const& path) : _in(path) {}
+
+        void skip_space()
+        {
+            while (is_space(_in.peek())) _in.get();
+        }
+
+        void expect(int c)
+        {
+            if (_in.get() != c) throw load_exception("malformed document");
+        }
+
+    public:
+        virtual ~document_reader() {}
+
+        // Reads up to the next event; false at the end of the document.
+        virtual bool next(parse_event& e) = 0;
+
+        // Reads the leaf value starting at 'offset' as text, cut off after
+        // 'limit' characters.
+        virtual std::wstring value(uint64_t offset, size_t limit) = 0;
+
+        uint64_t offset() const { return _in.offset(); }
+    };
+
+    // JSON: object members are named by their keys and array elements by
+    // their index.  The outermost object or array is not reported, so its
+    // members become the top-level nodes.
+    class json_reader : public document_reader
+    {
+        struct level
+        {
+            bool object;
+            size_t count;
+        };
+
+        std::vector<level> _stack;
+
+        // Reads a string, with the opening quote already consumed.
+        std::string read_string()
+        {
+            std::string s;
+            for (;;)
+            {
+                auto c = _in.get();
+                if (c < 0) throw load_exception("unterminated string");
+                if (c == '"') return s;
+                if (c != '\\')
+                {
+                    s += (char)c;
+                    continue;
+                }
+
+                switch (c = _in.get())
+                {
+                case 'b': s += '\b'; break;
+                case 'f': s += '\f'; break;
+                case 'n': s += '\n'; break;
+                case 'r': s += '\r'; break;
+                case 't': s += '\t'; break;
+                case 'u':
+                {
+                    auto cp = read_hex();
+                    if (cp >= 0xd800 && cp < 0xdc00 && _in.peek() == '\\')
+                    {
+                        _in.get();
+                        expect('u');
+                        auto low = read_hex();
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                    }
+                    append_code_point(s, cp);
+                    break;
+                }
+                default:
+                    if (c < 0) throw load_exception("unterminated string");
+                    s += (char)c;
+                }
+            }
+        }
+
+        uint32_t read_hex()
+        {
+            uint32_t v = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                auto c = _in.get();
+                if (c >= '0' && c <= '9') v = v * 16 + (c - '0');
+                else if (c >= 'a' && c <= 'f') v = v * 16 + (c - 'a' + 10);
+                else if (c >= 'A' && c <= 'F') v = v * 16 + (c - 'A' + 10);
+                else throw load_exception("bad \\u escape");
+            }
+            return v;
+        }
+
+        // Skips a string, number or literal without keeping it.
+        void skip_scalar()
+        {
+            if (_in.get() == '"')
+            {
+                for (int c; (c = _in.get()) != '"';)
+                {
+                    if (c < 0) throw load_exception("unterminated string");
+                    if (c == '\\') _in.get();
+                }
+                return;
+            }
+
+            for (int c; (c = _in.peek()) >= 0 && c != ',' && c != '}' && c != ']' && !is_space(c);)
+                _in.get();
+        }
+
+    public:
+        json_reader(std::filesystem::path const& path) : document_reader(path) {}
+
+        bool next(parse_event& e) override
+        {
+            for (;;)
+            {
+                skip_space();
+                auto c = _in.peek();
+
+                if (c < 0)
+                {
+                    if (!_stack.empty()) throw load_exception("truncated document");
+                    return false;
+                }
+
+                if (c == ',')
+                {
+                    _in.get();
+                    continue;
+                }
+
+                if (c == '}' || c == ']')
+                {
+                    _in.get();
+                    if (_stack.empty()) throw load_exception("malformed document");
+                    _stack.pop_back();
+                    if (_stack.empty()) continue;
+
+                    e.kind = parse_event::end;
+                    e.name.clear();
+                    e.offset = _in.offset();
+                    return true;
+                }
+
+                e.name.clear();
+                if (!_stack.empty() && _stack.back().object)
+                {
+                    expect('"');
+                    append_utf8(e.name, read_string());
+                    skip_space();
+                    expect(':');
+                    skip_space();
+                    c = _in.peek();
+                }
+                else if (!_stack.empty())
+                {
+                    e.name = L"[" + std::to_wstring(_stack.back().count) + L"]";
+                }
+                if (!_stack.empty()) _stack.back().count++;
+
+                e.offset = _in.offset();
+
+                if (c == '{' || c == '[')
+                {
+                    _in.get();
+                    level l = { c == '{', 0 };
+                    _stack.push_back(l);
+                    if (_stack.size() == 1) continue;
+
+                    e.kind = parse_event::begin;
+                    return true;
+                }
+
+                if (_stack.empty()) e.name = L"value";
+                e.kind = parse_event::leaf;
+                skip_scalar();
+                return true;
+            }
+        }
+
+        std::wstring value(uint64_t offset, size_t limit) override
+        {
+            _in.seek(offset);
+
+            std::string s;
+            if (_in.peek() == '"')
+            {
+                _in.get();
+                s = read_string();
+            }
+            else
+            {
+                for (int c; (c = _in.peek()) >= 0 && c != ',' && c != '}' && c != ']' && !is_space(c);)
+                    s += (char)_in.get();
+            }
+
+            std::wstring text;
+            append_utf8(text, s.size() > limit ? s.substr(0, limit) : s);
+            if (s.size() > limit) text += L"\x2026";
+            return text;
+        }
+    };
+
+    // XML: elements are containers, attributes are leaves named "@name",
+    // and text and CDATA are leaves named "#text".  Comments, processing
+    // instructions and declarations are skipped.
+    class xml_reader : public document_reader
+    {
+        std::deque<parse_event> _queued;
+        size_t _depth;
+
+        static bool is_name(int c)
+        {
+            return c > 0 && c != '>' && c != '/' && c != '=' && !is_space(c);
+        }
+
+        std::wstring read_name()
+        {
+            std::string s;
+            while (is_name(_in.peek())) s += (char)_in.get();
+            if (s.empty()) throw load_exception("malformed document");
+
+            std::wstring name;
+            append_utf8(name, s);
+            return name;
+        }
+
+        // Skips up to and including 'terminator'.
+        void skip_past(char const* terminator)
+        {
+            for (size_t matched = 0; terminator[matched] != 0;)
+            {
+                auto c = _in.get();
+                if (c < 0) throw load_exception("truncated document");
+                if (c == terminator[matched]) matched++;
+                else matched = c == terminator[0] ? 1 : 0;
+            }
+        }
+
+        bool skip_literal(char const* s)
+        {
+            for (; *s; s++)
+                if (_in.get() != *s) return false;
+            return true;
+        }
+
+        void queue(parse_event::kind_type kind, std::wstring const& name, uint64_t offset)
+        {
+            parse_event e = { kind, name, offset };
+            _queued.push_back(e);
+        }
+
+        // Reads the attributes and end of a start tag whose name has been
+        // read, queueing what they report.
+        void read_attributes()
+        {
+            for (;;)
+            {
+                skip_space();
+                auto c = _in.peek();
+
+                if (c == '>')
+                {
+                    _in.get();
+                    return;
+                }
+
+                if (c == '/')
+                {
+                    _in.get();
+                    expect('>');
+                    queue(parse_event::end, std::wstring(), _in.offset());
+                    _depth--;
+                    return;
+                }
+
+                auto name = L"@" + read_name();
+                skip_space();
+                expect('=');
+                skip_space();
+
+                auto quote = _in.peek();
+                if (quote != '"' && quote != '\'') throw load_exception("malformed attribute");
+                queue(parse_event::leaf, name, _in.offset());
+
+                _in.get();
+                for (int q; (q = _in.get()) != quote;)
+                    if (q < 0) throw load_exception("truncated document");
+            }
+        }
+
+        static std::string decode_entities(std::string const& s)
+        {
+            std::string out;
+            for (size_t i = 0; i < s.size(); i++)
+            {
+                auto semi = s[i] == '&' ? s.find(';', i) : std::string::npos;
+                if (semi == std::string::npos)
+                {
+                    out += s[i];
+                    continue;
+                }
+
+                auto entity = s.substr(i + 1, semi - i - 1);
+                if (entity == "lt") out += '<';
+                else if (entity == "gt") out += '>';
+                else if (entity == "amp") out += '&';
+                else if (entity == "quot") out += '"';
+                else if (entity == "apos") out += '\'';
+                else if (entity.size() > 1 && entity[0] == '#')
+                {
+                    auto cp = entity[1] == 'x' ?
+                        std::strtoul(entity.c_str() + 2, nullptr, 16) :
+                        std::strtoul(entity.c_str() + 1, nullptr, 10);
+                    append_code_point(out, (uint32_t)cp);
+                }
+                else
+                {
+                    out += s[i];
+                    continue;
+                }
+                i = semi;
+            }
+            return out;
+        }
+
+    public:
+        xml_reader(std::filesystem::path const& path) : document_reader(path), _depth(0) {}
+
+        bool next(parse_event& e) override
+        {
+            for (;;)
+            {
+                if (!_queued.empty())
+                {
+                    e = std::move(_queued.front());
+                    _queued.pop_front();
+                    return true;
+                }
+
+                auto c = _in.peek();
+                if (c < 0)
+                {
+                    if (_depth != 0) throw load_exception("truncated document");
+                    return false;
+                }
+
+                if (c != '<')
+                {
+                    // Text up to the next tag; only reported if not blank.
+                    uint64_t start = 0;
+                    bool blank = true;
+                    for (; (c = _in.peek()) >= 0 && c != '<'; _in.get())
+                    {
+                        if (blank && !is_space(c))
+                        {
+                            blank = false;
+                            start = _in.offset();
+                        }
+                    }
+
+                    if (blank || _depth == 0) continue;
+
+                    e.kind = parse_event::leaf;
+                    e.name = L"#text";
+                    e.offset = start;
+                    return true;
+                }
+
+                auto start = _in.offset();
+                _in.get();
+                c = _in.peek();
+
+                if (c == '?')
+                {
+                    skip_past("?>");
+                }
+                else if (c == '!')
+                {
+                    _in.get();
+                    if (_in.peek() == '-')
+                    {
+                        skip_past("-->");
+                    }
+                    else if (_in.peek() == '[')
+                    {
+                        if (!skip_literal("[CDATA[")) throw load_exception("malformed document");
+                        skip_past("]]>");
+
+                        e.kind = parse_event::leaf;
+                        e.name = L"#text";
+                        e.offset = start;
+                        return true;
+                    }
+                    else
+                    {
+                        // A declaration, with any internal subset in brackets.
+                        int nesting = 0;
+                        for (int d; (d = _in.get()) != '>' || nesting > 0;)
+                        {
+                            if (d < 0) throw load_exception("truncated document");
+                            if (d == '[') nesting++;
+                            if (d == ']') nesting--;
+                        }
+                    }
+                }
+                else if (c == '/')
+                {
+                    _in.get();
+                    read_name();
+                    skip_space();
+                    expect('>');
+                    if (_depth == 0) throw load_exception("malformed document");
+                    _depth--;
+
+                    e.kind = parse_event::end;
+                    e.name.clear();
+                    e.offset = _in.offset();
+                    return true;
+                }
+                else
+                {
+                    e.kind = parse_event::begin;
+                    e.name = read_name();
+                    e.offset = start;
+                    _depth++;
+                    read_attributes();
+                    return true;
+                }
+            }
+        }
+
+        std::wstring value(uint64_t offset, size_t limit) override
+        {
+            _in.seek(offset);
+
+            std::string s;
+            auto c = _in.get();
+
+            if (c == '"' || c == '\'')
+            {
+                for (int q; (q = _in.get()) >= 0 && q != c && s.size() <= limit * 4;)
+                    s += (char)q;
+            }
+            else if (c == '<')
+            {
+                skip_literal("![CDATA[");
+                for (int q; (q = _in.get()) >= 0 && s.size() <= limit * 4;)
+                {
+                    s += (char)q;
+                    if (s.size() >= 3 && s.compare(s.size() - 3, 3, "]]>") == 0)
+                    {
+                        s.resize(s.size() - 3);
+                        break;
+                    }
+                }
+            }
+            else
+            {
+                for (int q = c; q >= 0 && q != '<' && s.size() <= limit * 4; q = _in.get())
+                    s += (char)q;
+                while (!s.empty() && is_space((unsigned char)s.back())) s.pop_back();
+            }
+
+            if (c != '<') s = decode_entities(s);
+
+            std::wstring text;
+            append_utf8(text, s);
+            if (text.size() > limit)
+            {
+                text.resize(limit);
+                text += L"\x2026";
+            }
+            return text;
+        }
+    };
+
+    // Opens a JSON or XML reader, chosen by the file's extension.
+    std::unique_ptr<document_reader> open_document(std::filesystem::path const& path)
+    {
+        auto ext = path.extension();
+        if (ext == ".xml" || ext == ".XML")
+            return std::unique_ptr<document_reader>(new xml_reader(path));
+        return std::unique_ptr<document_reader>(new json_reader(path));
+    }
+
+    // Leaves of a streamed document keep only the offset of their value in
+    // 'index'; expanding one reads the value into a single child node.
+    // Has its own reader, so values can be read on the UI thread while the
+    // loader's reader is still parsing on another.
+    class document_source : public node_source
+    {
+        std::unique_ptr<document_reader> _reader;
+
+    public:
+        // Longest value shown, in characters.
+        static const size_t value_limit = 4096;
+
+        document_source(std::filesystem::path const& path) : _reader(open_document(path)) {}
+
+        void load(node& n) const override
+        {
+            node value(_reader->value(n.index, value_limit));
+            n.children.push_back(std::move(value));
+            n.children.back().parent = &n;
+        }
+    };
+
+    // A node parsed from a document and not yet in the model.  'parent'
+    // numbers the containers in document order, or is 'top' for the node
+    // the document is loaded under.
+    struct staged_node
+    {
+        static const uint64_t top = ~0ull;
+
+        uint64_t parent;
+        std::wstring name;
+        bool leaf;
+        uint64_t offset;
+    };
+
+    // Turns reader events into staged nodes, a batch at a time.  Runs off
+    // the UI thread; 'append' runs on it.
+    class document_loader
+    {
+        std::unique_ptr<document_reader> _reader;
+        std::vector<uint64_t> _open;
+        uint64_t _containers;
+        uint64_t _size;
+
+        // Model nodes of the containers appended so far, by number.
+        std::vector<node*> _nodes;
+
+    public:
+        document_loader(std::filesystem::path const& path)
+            : _reader(open_document(path)), _containers(0),
+            _size(std::filesystem::file_size(path)) {}
+
+        uint64_t size() const { return _size; }
+        uint64_t offset() const { return _reader->offset(); }
+
+        // Parses up to 'count' more nodes into 'batch'; false once the
+        // document is finished.
+        bool read(std::vector<staged_node>& batch, size_t count)
+        {
+            parse_event e;
+            while (batch.size() < count)
+            {
+                if (!_reader->next(e)) return false;
+
+                if (e.kind == parse_event::end)
+                {
+                    _open.pop_back();
+                    continue;
+                }
+
+                staged_node s;
+                s.parent = _open.empty() ? staged_node::top : _open.back();
+                s.name = std::move(e.name);
+                s.leaf = e.kind == parse_event::leaf;
+                s.offset = e.offset;
+
+                if (!s.leaf) _open.push_back(_containers++);
+                batch.push_back(std::move(s));
+            }
+            return true;
+        }
+
+        // Adds a batch to 'm' under 'top', leaves reading their value from
+        // 'values' when expanded.
+        void append(tree_model& m, node& top, std::vector<staged_node>& batch,
+            document_source const& values)
+        {
+            tree_model::batch b(m);
+
+            for (auto& s : batch)
+            {
+                auto& parent = s.parent == staged_node::top ? top : *_nodes[s.parent];
+
+                node n(std::move(s.name));
+                if (s.leaf)
+                {
+                    n.source = &values;
+                    n.index = s.offset;
+                }
+
+                auto it = m.append(parent, std::move(n));
+                if (!s.leaf) _nodes.push_back(&*it);
+            }
+            batch.clear();
+        }
+    };
+}
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <functional>
+#include <iterator>
+#include <list>
+#include <string>
+#include <vector>
+#include "snapshot.h"
+
+namespace model
+{
+    struct node;
+
+    // Where a lazily loaded node gets its children from.
+    class node_source
+    {
+    public:
+        virtual void load(node& n) const = 0;
+    };
+
+    struct node
+    {
+        typedef std::list<node>::iterator iterator;
+
+        std::wstring name;
+        std::list<node> children;
+        node* parent;
+        bool expanded;
+
+        // Dense key for side tables such as table columns, assigned when the
+        // node enters a tree_model; 0 until then.
+        uint32_t id;
+
+        // Nodes with a source only materialize their children once they are
+        // first expanded; 'index' says where the source finds them.
+        node_source const* source;
+        uint64_t index;
+
+        bool is_expanded() const
+        {
+            return expanded;
+        }
+
+        // True if every ancestor is expanded, so the node has a row.
+        bool is_visible() const
+        {
+            for (auto p = parent; p != nullptr; p = p->parent)
+                if (!p->expanded) return false;
+            return true;
+        }
+
+        void load();
+
+        node(std::wstring const& n)
+            : name(n), parent(nullptr), expanded(false), id(0), source(nullptr), index(0) {}
+
+        // Copies and moves are detached from any parent; their children are
+        // re-parented to them.  Copies are new nodes and get no id.
+        node(node const& other)
+            : name(other.name), children(other.children), parent(nullptr),
+            expanded(other.expanded), id(0), source(other.source), index(other.index)
+        {
+            adopt();
+        }
+
+        node(node&& other)
+            : name(std::move(other.name)), children(std::move(other.children)),
+            parent(nullptr), expanded(other.expanded), id(other.id),
+            source(other.source), index(other.index)
+        {
+            adopt();
+        }
+
+        node& operator=(node other)
+        {
+            name.swap(other.name);
+            children.swap(other.children);
+            expanded = other.expanded;
+            id = other.id;
+            source = other.source;
+            index = other.index;
+            adopt();
+            return *this;
+        }
+
+    private:
+        void adopt()
+        {
+            for (auto& c : children) c.parent = this;
+        }
+    };
+
+    void node::load()
+    {
+        if (source == nullptr) return;
+
+        auto s = source;
+        source = nullptr;
+        s->load(*this);
+    }
+
+    // Children read from a snapshot file, which must outlive the nodes.
+    class snapshot_source : public node_source
+    {
+        snapshot::file const& _file;
+
+    public:
+        snapshot_source(snapshot::file const& f) : _file(f) {}
+
+        node make(uint32_t i) const
+        {
+            node n(_file.name(i));
+            n.source = this;
+            n.index = i;
+
+            if (_file.is_expanded(i))
+            {
+                n.expanded = true;
+                n.load();
+            }
+            return n;
+        }
+
+        node root() const { return make(_file.root()); }
+
+        void load(node& n) const override
+        {
+            auto& r = _file.at((uint32_t)n.index);
+            for (uint32_t i = r.first_child; i < r.first_child + r.child_count; i++)
+            {
+                n.children.push_back(make(i));
+                n.children.back().parent = &n;
+            }
+        }
+    };
+
+    // One structural or state change.  Inserted, removed and moved nodes
+    // are the siblings first..last (inclusive), 'count' of them, under
+    // 'parent'.  Removed nodes are still readable while observers run.
+    struct change
+    {
+        enum kind_type { insert, remove, move, rename, expand };
+
+        kind_type kind;
+        node* parent;
+        node::iterator first;
+        node::iterator last;
+        size_t count;
+
+        // rename, expand: the node; move: its previous parent.
+        node* target;
+    };
+
+    typedef std::vector<change> change_list;
+    typedef std::function<void(change_list const&)> observer;
+
+    // Owns a tree and reports every edit made through it.  Edits inside a
+    // batch are delivered together when the outermost batch ends, with
+    // runs of adjacent inserts or removes under one parent coalesced into a
+    // single change.
+    class tree_model
+    {
+        node _root;
+        std::list<observer> _observers;
+        change_list _pending;
+        std::list<node> _removed;
+        int _batch_depth;
+        uint32_t _next_id;
+
+        tree_model(tree_model const&);
+        tree_model& operator=(tree_model const&);
+
+        void notify(change const& c)
+        {
+            if (!_pending.empty())
+            {
+                auto& prev = _pending.back();
+                if ((c.kind == change::insert || c.kind == change::remove) &&
+                    prev.kind == c.kind && prev.parent == c.parent &&
+                    std::next(prev.last) == c.first)
+                {
+                    prev.last = c.last;
+                    prev.count += c.count;
+                    return;
+                }
+            }
+
+            _pending.push_back(c);
+            if (_batch_depth == 0) flush();
+        }
+
+        void flush()
+        {
+            if (_pending.empty()) return;
+
+            for (auto& o : _observers) o(_pending);
+            _pending.clear();
+            _removed.clear();
+        }
+
+        void assign_ids(node& n)
+        {
+            if (n.id == 0) n.id = _next_id++;
+            for (auto& c : n.children) assign_ids(c);
+        }
+
+        static change make(change::kind_type kind, node* parent,
+            node::iterator first, node::iterator last, size_t count, node* target)
+        {
+            change c;
+            c.kind = kind;
+            c.parent = parent;
+            c.first = first;
+            c.last = last;
+            c.count = count;
+            c.target = target;
+            return c;
+        }
+
+    public:
+        typedef std::list<observer>::iterator subscription;
+
+        tree_model(std::wstring const& name) : _root(name), _batch_depth(0), _next_id(1)
+        {
+            _root.expanded = true;
+            assign_ids(_root);
+        }
+
+        // Upper bound of the ids handed out so far.
+        uint32_t id_limit() const { return _next_id; }
+
+        node& root() { return _root; }
+
+        subscription subscribe(observer f)
+        {
+            _observers.push_back(f);
+            return std::prev(_observers.end());
+        }
+
+        void unsubscribe(subscription s)
+        {
+            _observers.erase(s);
+        }
+
+        class batch
+        {
+            tree_model& _model;
+
+        public:
+            batch(tree_model& m) : _model(m) { _model._batch_depth++; }
+
+            ~batch()
+            {
+                if (--_model._batch_depth == 0) _model.flush();
+            }
+        };
+
+        node::iterator insert(node& parent, node::iterator before, node n)
+        {
+            auto it = parent.children.insert(before, std::move(n));
+            it->parent = &parent;
+            assign_ids(*it);
+            notify(make(change::insert, &parent, it, it, 1, nullptr));
+            return it;
+        }
+
+        node::iterator append(node& parent, node n)
+        {
+            return insert(parent, parent.children.end(), std::move(n));
+        }
+
+        // Removes the children [first, last) of 'parent'.
+        void remove(node& parent, node::iterator first, node::iterator last)
+        {
+            if (first == last) return;
+
+            auto count = (size_t)std::distance(first, last);
+            auto tail = std::prev(last);
+            _removed.splice(_removed.end(), parent.children, first, last);
+
+            notify(make(change::remove, &parent, first, tail, count, nullptr));
+        }
+
+        void move(node& from, node::iterator it, node& to, node::iterator before)
+        {
+            to.children.splice(before, from.children, it);
+            it->parent = &to;
+            notify(make(change::move, &to, it, it, 1, &from));
+        }
+
+        void rename(node& n, std::wstring const& name)
+        {
+            n.name = name;
+            notify(make(change::rename, n.parent, node::iterator(), node::iterator(), 1, &n));
+        }
+
+        void set_expanded(node& n, bool expanded)
+        {
+            if (n.expanded == expanded) return;
+
+            if (expanded && n.source != nullptr)
+            {
+                n.load();
+                assign_ids(n);
+            }
+            n.expanded = expanded;
+            notify(make(change::expand, n.parent, node::iterator(), node::iterator(), 1, &n));
+        }
+    };
+}
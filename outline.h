@@ -0,0 +1,132 @@
+#pragma once
+
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "geometry.h"
+#include "layout.h"
+#include "tree.h"
+
+namespace ui
+{
+    // A node whose children arrange_rows is still laying out.
+    template <typename Adapter>
+    struct outline_level
+    {
+        std::pair<typename Adapter::child_iterator, typename Adapter::child_iterator> children;
+        size_t parent;
+        drawing::distance left;
+    };
+
+    // Rebuilds 'layout' at 'width' with the rows below the root of 'tree':
+    // each node, then, when expanded(h), its children indented by
+    // 'indent'.  The tree is walked with 'stack' rather than by recursion,
+    // since parent-index data may nest deeper than the call stack allows.
+    // Committing the layout is left to the caller.
+    template <typename Adapter, typename Expanded>
+    void arrange_rows(Adapter const& tree, Expanded expanded, drawing::distance indent,
+        drawing::distance width, tree_layout<typename Adapter::handle>& layout,
+        std::vector<outline_level<Adapter> >& stack)
+    {
+        typedef tree_layout<typename Adapter::handle> layout_type;
+
+        layout.rebuild(width);
+        drawing::distance bottom = 0;
+
+        outline_level<Adapter> top = { tree.children(tree.root()), layout_type::none, 0 };
+        stack.push_back(top);
+
+        while (!stack.empty())
+        {
+            auto& l = stack.back();
+            if (l.children.first == l.children.second)
+            {
+                if (l.parent != layout_type::none)
+                    layout.at(l.parent).children.bottom = bottom;
+                stack.pop_back();
+                continue;
+            }
+
+            auto h = tree.handle_of(l.children.first);
+            ++l.children.first;
+
+            typename layout_type::row r;
+            r.node = h;
+            r.parent = l.parent;
+            r.bounds = drawing::rectangle(l.left, bottom, width, bottom + tree.row_height(h));
+            r.expander = drawing::from_left(r.bounds, 10);
+            r.label = drawing::to_right(r.bounds, 15);
+            r.expanded = expanded(h);
+
+            auto index = layout.add(r);
+            bottom = r.bounds.bottom;
+
+            if (r.expanded)
+            {
+                auto left = l.left + indent;
+                layout.at(index).children = drawing::rectangle(left, bottom, width, bottom);
+
+                outline_level<Adapter> below = { tree.children(h), index, left };
+                stack.push_back(below);
+            }
+        }
+    }
+
+    // Expansion state and layout of a tree shown through an adapter (see
+    // tree.h).  Rows refer to nodes by handle and only expanded nodes are
+    // walked, so a tree of millions of nodes costs only the rows that are
+    // open.
+    template <typename Adapter>
+    class tree_outline
+    {
+    public:
+        typedef typename Adapter::handle handle;
+        typedef ui::tree_layout<handle> layout_type;
+        typedef typename layout_type::row row;
+
+    private:
+        Adapter const& _tree;
+        std::unordered_set<handle> _expanded;
+        layout_type _layout;
+        drawing::distance _indent;
+        std::vector<outline_level<Adapter> > _stack;
+
+        tree_outline(tree_outline const&);
+        tree_outline& operator=(tree_outline const&);
+
+    public:
+        tree_outline(Adapter const& tree, drawing::distance indent = 10)
+            : _tree(tree), _indent(indent) {}
+
+        Adapter const& tree() const { return _tree; }
+        layout_type const& layout() const { return _layout; }
+
+        bool is_expanded(handle h) const { return _expanded.count(h) != 0; }
+
+        void set_expanded(handle h, bool expanded)
+        {
+            if (expanded && _tree.expandable(h)) _expanded.insert(h);
+            else _expanded.erase(h);
+            _layout.invalidate();
+        }
+
+        void toggle(handle h) { set_expanded(h, !is_expanded(h)); }
+
+        // Lays out the rows again if the expansion changed, or just widens
+        // them if only the width did.
+        void arrange(drawing::distance width)
+        {
+            if (_layout.valid(width)) return;
+
+            if (_layout.valid(_layout.width()))
+            {
+                _layout.resize(width);
+                return;
+            }
+
+            arrange_rows(_tree, [this](handle h) { return is_expanded(h); },
+                _indent, width, _layout, _stack);
+            _layout.commit();
+        }
+    };
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "profile.h"
+
+namespace parallel
+{
+    // A fixed set of worker threads, one per core besides the caller's,
+    // that run the chunks of one job at a time.
+    class thread_pool
+    {
+        std::vector<std::thread> _threads;
+        std::mutex _lock;
+        std::condition_variable _wake;
+        std::condition_variable _finished;
+
+        std::function<void(size_t)> const* _job;
+        size_t _next;
+        size_t _chunks;
+        size_t _busy;
+        bool _stopping;
+
+        thread_pool(thread_pool const&);
+        thread_pool& operator=(thread_pool const&);
+
+        // Takes chunks until none are left; called with _lock held.
+        void drain(std::unique_lock<std::mutex>& hold)
+        {
+            while (_next < _chunks)
+            {
+                auto i = _next++;
+                _busy++;
+
+                hold.unlock();
+                {
+                    TRACE_ZONE("pool chunk");
+                    (*_job)(i);
+                }
+                hold.lock();
+
+                if (--_busy == 0 && _next == _chunks) _finished.notify_all();
+            }
+        }
+
+        void work()
+        {
+            diagnostics::name_thread("worker");
+
+            std::unique_lock<std::mutex> hold(_lock);
+            for (;;)
+            {
+                _wake.wait(hold, [this]() { return _stopping || _next < _chunks; });
+                if (_stopping) return;
+                drain(hold);
+            }
+        }
+
+    public:
+        thread_pool(size_t threads)
+            : _job(nullptr), _next(0), _chunks(0), _busy(0), _stopping(false)
+        {
+            for (size_t i = 0; i < threads; i++)
+                _threads.emplace_back([this]() { work(); });
+        }
+
+        ~thread_pool()
+        {
+            {
+                std::lock_guard<std::mutex> hold(_lock);
+                _stopping = true;
+            }
+            _wake.notify_all();
+            for (auto& t : _threads) t.join();
+        }
+
+        static thread_pool& instance()
+        {
+            static thread_pool pool((std::max)(1u, std::thread::hardware_concurrency()) - 1);
+            return pool;
+        }
+
+        // Threads that take part in a run, counting the caller.
+        size_t size() const { return _threads.size() + 1; }
+
+        // Calls job(i) for every i in [0, chunks), on the workers and the
+        // calling thread, and returns once all calls have.  Runs from
+        // several threads at once are taken one after another.
+        void run(size_t chunks, std::function<void(size_t)> const& job)
+        {
+            static std::mutex one_at_a_time;
+            std::lock_guard<std::mutex> turn(one_at_a_time);
+
+            std::unique_lock<std::mutex> hold(_lock);
+            _job = &job;
+            _next = 0;
+            _chunks = chunks;
+            _wake.notify_all();
+
+            drain(hold);
+            _finished.wait(hold, [this]() { return _busy == 0; });
+
+            _job = nullptr;
+            _chunks = _next = 0;
+        }
+    };
+
+    // Calls f(begin, end) over [0, n) in one slice per thread, or in one
+    // call on this thread when n is under two grains.
+    template <typename F>
+    void for_each_slice(thread_pool& pool, size_t n, size_t grain, F const& f)
+    {
+        auto slices = (std::min)(pool.size(), n / (std::max)(grain, (size_t)1));
+        if (slices < 2)
+        {
+            f((size_t)0, n);
+            return;
+        }
+
+        std::function<void(size_t)> job = [&](size_t i)
+        {
+            f(n * i / slices, n * (i + 1) / slices);
+        };
+        pool.run(slices, job);
+    }
+
+    // Sorts each thread's slice of 'v' at the same time, then merges the
+    // slices pairwise, the merges of a round also running in parallel.
+    template <typename T, typename Less>
+    void sort(thread_pool& pool, std::vector<T>& v, Less const& less, size_t grain = 16 * 1024)
+    {
+        auto slices = (std::min)(pool.size(), v.size() / grain);
+        if (slices < 2)
+        {
+            std::sort(v.begin(), v.end(), less);
+            return;
+        }
+
+        std::vector<size_t> bounds(slices + 1);
+        for (size_t i = 0; i <= slices; i++) bounds[i] = v.size() * i / slices;
+
+        std::function<void(size_t)> sort_slice = [&](size_t i)
+        {
+            std::sort(v.begin() + bounds[i], v.begin() + bounds[i + 1], less);
+        };
+        pool.run(slices, sort_slice);
+
+        for (size_t width = 1; width < slices; width *= 2)
+        {
+            std::function<void(size_t)> merge = [&](size_t m)
+            {
+                auto first = bounds[2 * m * width];
+                auto middle = bounds[(std::min)(slices, (2 * m + 1) * width)];
+                auto last = bounds[(std::min)(slices, (2 * m + 2) * width)];
+                std::inplace_merge(v.begin() + first, v.begin() + middle, v.begin() + last, less);
+            };
+            pool.run((slices + 2 * width - 1) / (2 * width), merge);
+        }
+    }
+}
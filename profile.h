@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Timeline zones for Chrome's about:tracing and Perfetto.  With
+// GUI_TRACE_ZONES defined, TRACE_ZONE("name") records the time from there
+// to the end of the enclosing scope on the calling thread, while tracing
+// is switched on at runtime; without it the macro expands to nothing.
+// Names must be string literals: only the pointer is kept.
+#ifdef GUI_TRACE_ZONES
+#define TRACE_ZONE_JOIN2(a, b) a##b
+#define TRACE_ZONE_JOIN(a, b) TRACE_ZONE_JOIN2(a, b)
+#define TRACE_ZONE(name) diagnostics::zone TRACE_ZONE_JOIN(trace_zone_, __LINE__)(name)
+#else
+#define TRACE_ZONE(name)
+#endif
+
+namespace diagnostics
+{
+    // Zones one thread has closed, most recent last.  Only the owning
+    // thread writes; the ring keeps the latest 'capacity' and overwrites
+    // older ones without waiting for them to be read.  The ring is made by
+    // the first push, so threads that are only named cost no more than
+    // their name.
+    class zone_buffer
+    {
+    public:
+        static const size_t capacity = 64 * 1024;
+
+        struct event
+        {
+            char const* name;
+            uint64_t begin;  // ns since the process started tracing
+            uint64_t end;
+        };
+
+    private:
+        // Fields are atomics so that a flush reading a slot the owner is
+        // overwriting is a detectable race rather than undefined behaviour.
+        struct slot
+        {
+            std::atomic<char const*> name;
+            std::atomic<uint64_t> begin;
+            std::atomic<uint64_t> end;
+        };
+
+        std::unique_ptr<slot[]> _slots;
+        std::atomic<uint64_t> _written;
+        uint32_t _thread;
+
+    public:
+        zone_buffer(uint32_t thread) : _written(0), _thread(thread) {}
+
+        uint32_t thread() const { return _thread; }
+
+        // Set and read under the registry's lock.
+        std::string name;
+
+        void push(char const* name, uint64_t begin, uint64_t end)
+        {
+            auto n = _written.load(std::memory_order_relaxed);
+            if (n == 0 && !_slots) _slots.reset(new slot[capacity]);
+            auto& s = _slots[n % capacity];
+            s.name.store(name, std::memory_order_relaxed);
+            s.begin.store(begin, std::memory_order_relaxed);
+            s.end.store(end, std::memory_order_relaxed);
+            _written.store(n + 1, std::memory_order_release);
+        }
+
+        // Appends the zones written since 'from' that are still held, and
+        // returns the count written so far for the next call.  Slots the
+        // owner may have reused, or be reusing, while they were copied are
+        // dropped.
+        uint64_t read(uint64_t from, std::vector<event>& out) const
+        {
+            auto written = _written.load(std::memory_order_acquire);
+            if (written > capacity && from < written - capacity) from = written - capacity;
+
+            auto start = out.size();
+            for (auto i = from; i < written; i++)
+            {
+                auto& s = _slots[i % capacity];
+                event e = {
+                    s.name.load(std::memory_order_relaxed),
+                    s.begin.load(std::memory_order_relaxed),
+                    s.end.load(std::memory_order_relaxed) };
+                out.push_back(e);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            auto reused = _written.load(std::memory_order_relaxed) + 1;
+            if (reused > capacity && from < reused - capacity)
+            {
+                auto lost = (std::min)(reused - capacity - from, written - from);
+                out.erase(out.begin() + start, out.begin() + start + (size_t)lost);
+            }
+            return written;
+        }
+    };
+
+    // Owns every thread's buffer; buffers outlive their threads so their
+    // zones can still be exported.
+    class zone_registry
+    {
+        std::mutex _lock;
+        std::vector<std::unique_ptr<zone_buffer> > _buffers;
+        std::atomic<bool> _enabled;
+        std::chrono::steady_clock::time_point _start;
+
+        zone_registry() : _enabled(false), _start(std::chrono::steady_clock::now()) {}
+
+    public:
+        static zone_registry& instance()
+        {
+            static zone_registry registry;
+            return registry;
+        }
+
+        bool enabled() const { return _enabled.load(std::memory_order_relaxed); }
+        void enable(bool on) { _enabled.store(on, std::memory_order_relaxed); }
+
+        uint64_t now() const
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - _start).count();
+        }
+
+        // The calling thread's buffer, made on first use.
+        zone_buffer& local()
+        {
+            thread_local zone_buffer* buffer = nullptr;
+            if (buffer == nullptr)
+            {
+                std::lock_guard<std::mutex> hold(_lock);
+                _buffers.emplace_back(new zone_buffer((uint32_t)_buffers.size() + 1));
+                buffer = _buffers.back().get();
+            }
+            return *buffer;
+        }
+
+        void name_thread(char const* name)
+        {
+            auto& b = local();
+            std::lock_guard<std::mutex> hold(_lock);
+            b.name = name;
+        }
+
+        // Writes everything the buffers hold as Chrome trace-event JSON,
+        // one complete ("X") event per zone with times in microseconds.
+        void write(std::ostream& out)
+        {
+            std::lock_guard<std::mutex> hold(_lock);
+
+            out << "{\"traceEvents\":[";
+            bool first = true;
+            char number[32];
+
+            for (auto& b : _buffers)
+            {
+                if (!b->name.empty())
+                {
+                    out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+                        << b->thread() << ",\"args\":{\"name\":\"" << b->name << "\"}}";
+                    first = false;
+                }
+
+                std::vector<zone_buffer::event> events;
+                b->read(0, events);
+
+                for (auto& e : events)
+                {
+                    out << (first ? "" : ",") << "\n{\"name\":\"" << e.name
+                        << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << b->thread();
+                    snprintf(number, sizeof(number), "%.3f", e.begin / 1000.0);
+                    out << ",\"ts\":" << number;
+                    snprintf(number, sizeof(number), "%.3f", (e.end - e.begin) / 1000.0);
+                    out << ",\"dur\":" << number << "}";
+                    first = false;
+                }
+            }
+
+            out << "\n]}\n";
+        }
+    };
+
+    // Names the calling thread in exported traces.  Without
+    // GUI_TRACE_ZONES there are no traces, and it does nothing.
+    inline void name_thread(char const* name)
+    {
+#ifdef GUI_TRACE_ZONES
+        zone_registry::instance().name_thread(name);
+#else
+        (void)name;
+#endif
+    }
+
+    // One TRACE_ZONE.  When tracing is off it costs a relaxed load.
+    class zone
+    {
+        char const* _name;
+        uint64_t _begin;
+
+        zone(zone const&);
+        zone& operator=(zone const&);
+
+    public:
+        zone(char const* name) : _name(nullptr)
+        {
+            auto& r = zone_registry::instance();
+            if (!r.enabled()) return;
+
+            _name = name;
+            _begin = r.now();
+        }
+
+        ~zone()
+        {
+            if (_name == nullptr) return;
+
+            auto& r = zone_registry::instance();
+            r.local().push(_name, _begin, r.now());
+        }
+    };
+}
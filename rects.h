@@ -0,0 +1,371 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "geometry.h"
+
+// Batch kernels run 8 lanes wide with AVX, 4 with SSE and one at a time for
+// whatever is left over, or for everything when GEOMETRY_SCALAR is defined.
+#ifndef GEOMETRY_SCALAR
+#if defined(__AVX__)
+#include <immintrin.h>
+#define GEOMETRY_AVX
+#endif
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define GEOMETRY_SSE
+#endif
+#endif
+
+namespace drawing
+{
+    // Rectangles stored as one array per edge, so the batch kernels below
+    // can load the same edge of several rectangles at once.
+    struct rect_array
+    {
+        std::vector<float> left;
+        std::vector<float> top;
+        std::vector<float> right;
+        std::vector<float> bottom;
+
+        size_t size() const { return left.size(); }
+
+        void clear()
+        {
+            left.clear();
+            top.clear();
+            right.clear();
+            bottom.clear();
+        }
+
+        void reserve(size_t n)
+        {
+            left.reserve(n);
+            top.reserve(n);
+            right.reserve(n);
+            bottom.reserve(n);
+        }
+
+        void push_back(rectangle const& r)
+        {
+            left.push_back(r.left);
+            top.push_back(r.top);
+            right.push_back(r.right);
+            bottom.push_back(r.bottom);
+        }
+
+        rectangle at(size_t i) const
+        {
+            return rectangle(left[i], top[i], right[i], bottom[i]);
+        }
+    };
+
+    // Lanes of floats with the handful of operations the kernels need.
+    namespace simd
+    {
+        struct f1
+        {
+            static const size_t width = 1;
+            float v;
+
+            static f1 load(float const* p) { f1 r = { *p }; return r; }
+            static f1 all(float x) { f1 r = { x }; return r; }
+            void store(float* p) const { *p = v; }
+
+            friend f1 operator+(f1 a, f1 b) { f1 r = { a.v + b.v }; return r; }
+            friend f1 operator*(f1 a, f1 b) { f1 r = { a.v * b.v }; return r; }
+            friend f1 min(f1 a, f1 b) { f1 r = { b.v < a.v ? b.v : a.v }; return r; }
+            friend f1 max(f1 a, f1 b) { f1 r = { a.v < b.v ? b.v : a.v }; return r; }
+
+            // Bit i set where lane i of a <= b, or of a < b.
+            friend unsigned less_equal(f1 a, f1 b) { return a.v <= b.v ? 1 : 0; }
+            friend unsigned less(f1 a, f1 b) { return a.v < b.v ? 1 : 0; }
+
+            float reduce_min() const { return v; }
+            float reduce_max() const { return v; }
+        };
+
+#ifdef GEOMETRY_SSE
+        struct f4
+        {
+            static const size_t width = 4;
+            __m128 v;
+
+            static f4 load(float const* p) { f4 r = { _mm_loadu_ps(p) }; return r; }
+            static f4 all(float x) { f4 r = { _mm_set1_ps(x) }; return r; }
+            void store(float* p) const { _mm_storeu_ps(p, v); }
+
+            friend f4 operator+(f4 a, f4 b) { f4 r = { _mm_add_ps(a.v, b.v) }; return r; }
+            friend f4 operator*(f4 a, f4 b) { f4 r = { _mm_mul_ps(a.v, b.v) }; return r; }
+            friend f4 min(f4 a, f4 b) { f4 r = { _mm_min_ps(a.v, b.v) }; return r; }
+            friend f4 max(f4 a, f4 b) { f4 r = { _mm_max_ps(a.v, b.v) }; return r; }
+
+            friend unsigned less_equal(f4 a, f4 b) { return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v)); }
+            friend unsigned less(f4 a, f4 b) { return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)); }
+
+            float reduce_min() const
+            {
+                auto m = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+                m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+                return _mm_cvtss_f32(m);
+            }
+
+            float reduce_max() const
+            {
+                auto m = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+                m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+                return _mm_cvtss_f32(m);
+            }
+        };
+#endif
+
+#ifdef GEOMETRY_AVX
+        struct f8
+        {
+            static const size_t width = 8;
+            __m256 v;
+
+            static f8 load(float const* p) { f8 r = { _mm256_loadu_ps(p) }; return r; }
+            static f8 all(float x) { f8 r = { _mm256_set1_ps(x) }; return r; }
+            void store(float* p) const { _mm256_storeu_ps(p, v); }
+
+            friend f8 operator+(f8 a, f8 b) { f8 r = { _mm256_add_ps(a.v, b.v) }; return r; }
+            friend f8 operator*(f8 a, f8 b) { f8 r = { _mm256_mul_ps(a.v, b.v) }; return r; }
+            friend f8 min(f8 a, f8 b) { f8 r = { _mm256_min_ps(a.v, b.v) }; return r; }
+            friend f8 max(f8 a, f8 b) { f8 r = { _mm256_max_ps(a.v, b.v) }; return r; }
+
+            friend unsigned less_equal(f8 a, f8 b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)); }
+            friend unsigned less(f8 a, f8 b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+
+            float reduce_min() const
+            {
+                f4 low = { _mm256_castps256_ps128(v) };
+                f4 high = { _mm256_extractf128_ps(v, 1) };
+                return min(low, high).reduce_min();
+            }
+
+            float reduce_max() const
+            {
+                f4 low = { _mm256_castps256_ps128(v) };
+                f4 high = { _mm256_extractf128_ps(v, 1) };
+                return max(low, high).reduce_max();
+            }
+        };
+#endif
+
+        // Runs 'kernel' over [first, last): the widest lanes first, then
+        // narrower ones for the remainder.  kernel.template run<V>(i)
+        // handles the V::width items starting at i.
+        template <typename Kernel>
+        void for_lanes(size_t first, size_t last, Kernel& kernel)
+        {
+            size_t i = first;
+#ifdef GEOMETRY_AVX
+            for (; i + f8::width <= last; i += f8::width) kernel.template run<f8>(i);
+#endif
+#ifdef GEOMETRY_SSE
+            for (; i + f4::width <= last; i += f4::width) kernel.template run<f4>(i);
+#endif
+            for (; i < last; i++) kernel.template run<f1>(i);
+        }
+
+        template <typename Kernel>
+        void for_lanes(size_t n, Kernel& kernel)
+        {
+            for_lanes(0, n, kernel);
+        }
+    }
+
+    struct intersect_kernel
+    {
+        rect_array& r;
+        rectangle const& clip;
+
+        template <typename V>
+        void run(size_t i)
+        {
+            auto left = max(V::load(&r.left[i]), V::all(clip.left));
+            auto top = max(V::load(&r.top[i]), V::all(clip.top));
+            auto right = max(min(V::load(&r.right[i]), V::all(clip.right)), left);
+            auto bottom = max(min(V::load(&r.bottom[i]), V::all(clip.bottom)), top);
+
+            left.store(&r.left[i]);
+            top.store(&r.top[i]);
+            right.store(&r.right[i]);
+            bottom.store(&r.bottom[i]);
+        }
+    };
+
+    // Clips every rectangle to 'clip'.  Rectangles outside it come out with
+    // zero width or height.
+    void intersect(rect_array& r, rectangle const& clip)
+    {
+        intersect_kernel k = { r, clip };
+        simd::for_lanes(r.size(), k);
+    }
+
+    struct contains_kernel
+    {
+        rect_array const& r;
+        point const& p;
+        uint8_t* hits;
+        size_t count;
+
+        template <typename V>
+        void run(size_t i)
+        {
+            auto x = V::all(p.x);
+            auto y = V::all(p.y);
+
+            auto mask =
+                less_equal(V::load(&r.left[i]), x) &
+                less_equal(V::load(&r.top[i]), y) &
+                less(x, V::load(&r.right[i])) &
+                less(y, V::load(&r.bottom[i]));
+
+            for (size_t lane = 0; lane < V::width; lane++)
+            {
+                auto hit = (mask >> lane) & 1;
+                hits[i + lane] = (uint8_t)hit;
+                count += hit;
+            }
+        }
+    };
+
+    // Sets hits[i] to 1 where rectangle i contains 'p', as contains() does
+    // for one rectangle, and 0 elsewhere.  Returns the number of hits.
+    size_t contains(rect_array const& r, point const& p, uint8_t* hits)
+    {
+        contains_kernel k = { r, p, hits, 0 };
+        simd::for_lanes(r.size(), k);
+        return k.count;
+    }
+
+    struct find_containing_kernel
+    {
+        rect_array const& r;
+        point const& p;
+        size_t last;
+        size_t found;
+
+        template <typename V>
+        void run(size_t i)
+        {
+            if (found != last) return;
+
+            auto x = V::all(p.x);
+            auto y = V::all(p.y);
+
+            auto mask =
+                less_equal(V::load(&r.left[i]), x) &
+                less_equal(V::load(&r.top[i]), y) &
+                less(x, V::load(&r.right[i])) &
+                less(y, V::load(&r.bottom[i]));
+
+            for (size_t lane = 0; lane < V::width; lane++)
+            {
+                if ((mask >> lane) & 1)
+                {
+                    found = i + lane;
+                    return;
+                }
+            }
+        }
+    };
+
+    // Index of the first rectangle in [first, last) that contains 'p', or
+    // 'last' if none does.
+    size_t find_containing(rect_array const& r, size_t first, size_t last, point const& p)
+    {
+        find_containing_kernel k = { r, p, last, last };
+        simd::for_lanes(first, last, k);
+        return k.found;
+    }
+
+    struct bounds_kernel
+    {
+        rect_array const& r;
+        float left, top, right, bottom;
+
+        template <typename V>
+        void run(size_t i)
+        {
+            left = (std::min)(left, V::load(&r.left[i]).reduce_min());
+            top = (std::min)(top, V::load(&r.top[i]).reduce_min());
+            right = (std::max)(right, V::load(&r.right[i]).reduce_max());
+            bottom = (std::max)(bottom, V::load(&r.bottom[i]).reduce_max());
+        }
+    };
+
+    // Smallest rectangle covering all of 'r'; empty at the origin if 'r' is.
+    rectangle bounds(rect_array const& r)
+    {
+        if (r.size() == 0) return rectangle();
+
+        bounds_kernel k = { r, r.left[0], r.top[0], r.right[0], r.bottom[0] };
+        simd::for_lanes(r.size(), k);
+        return rectangle(k.left, k.top, k.right, k.bottom);
+    }
+
+    struct transform_points_kernel
+    {
+        matrix3x2 const& m;
+        float* x;
+        float* y;
+
+        template <typename V>
+        void run(size_t i)
+        {
+            auto px = V::load(x + i);
+            auto py = V::load(y + i);
+
+            (px * V::all(m._11) + py * V::all(m._21) + V::all(m._31)).store(x + i);
+            (px * V::all(m._12) + py * V::all(m._22) + V::all(m._32)).store(y + i);
+        }
+    };
+
+    // Applies 'm' to the points (x[i], y[i]) in place.
+    void transform_points(matrix3x2 const& m, float* x, float* y, size_t n)
+    {
+        transform_points_kernel k = { m, x, y };
+        simd::for_lanes(n, k);
+    }
+
+    struct transform_rects_kernel
+    {
+        matrix3x2 const& m;
+        rect_array& r;
+
+        template <typename V>
+        void run(size_t i)
+        {
+            auto l = V::load(&r.left[i]);
+            auto t = V::load(&r.top[i]);
+            auto rt = V::load(&r.right[i]);
+            auto b = V::load(&r.bottom[i]);
+
+            // Edges scaled by each matrix column; the extremes of a
+            // transformed rectangle come from picking per column.
+            auto x1 = l * V::all(m._11), x2 = rt * V::all(m._11);
+            auto x3 = t * V::all(m._21), x4 = b * V::all(m._21);
+            auto y1 = l * V::all(m._12), y2 = rt * V::all(m._12);
+            auto y3 = t * V::all(m._22), y4 = b * V::all(m._22);
+
+            auto dx = V::all(m._31);
+            auto dy = V::all(m._32);
+
+            (min(x1, x2) + min(x3, x4) + dx).store(&r.left[i]);
+            (max(x1, x2) + max(x3, x4) + dx).store(&r.right[i]);
+            (min(y1, y2) + min(y3, y4) + dy).store(&r.top[i]);
+            (max(y1, y2) + max(y3, y4) + dy).store(&r.bottom[i]);
+        }
+    };
+
+    // Replaces every rectangle by the bounds of its image under 'm'.
+    void transform_rects(matrix3x2 const& m, rect_array& r)
+    {
+        transform_rects_kernel k = { m, r };
+        simd::for_lanes(r.size(), k);
+    }
+}
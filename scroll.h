@@ -0,0 +1,251 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include "clock.h"
+#include "drawing.h"
+#include "target.h"
+
+namespace drawing
+{
+    // Caches the content of a scrolled viewport in a bitmap.  When only the
+    // scroll offset changed since the last frame the cached pixels are
+    // shifted and just the newly exposed strip is painted, so the cost of a
+    // scroll step follows the exposed area rather than the viewport area.
+    class scroll_surface
+    {
+        struct layer : d2d::render_target
+        {
+            d2d::scoped_resource<ID2D1BitmapRenderTarget> resource;
+
+            ID2D1RenderTarget* get_target() override { return resource.get(); }
+        };
+
+        layer _layers[2];
+        int _front;
+        d2d::render_target* _parent;
+        unsigned _generation;
+        distance _width, _height;
+        distance _offset;
+        bool _valid;
+        rectangle _dirty;
+
+        // Content band to repaint on the next render, in content
+        // coordinates; empty when the top is not above the bottom.
+        distance _stale_top, _stale_bottom;
+
+        void create(target const& t)
+        {
+            auto native = t.rtarget->get_target();
+            for (auto& l : _layers)
+            {
+                l.resource.release();
+                d2d::throw_call(native->CreateCompatibleRenderTarget(
+                    D2D1::SizeF(t.width(), t.height()), &l.resource));
+            }
+
+            _parent = t.rtarget;
+            _generation = t.rtarget->generation();
+            _width = t.width();
+            _height = t.height();
+        }
+
+        // Offsets are kept on the device pixel grid so shifted content is
+        // copied exactly instead of being resampled.
+        distance snap(target const& t, distance offset) const
+        {
+            FLOAT dpi_x, dpi_y;
+            t.rtarget->get_target()->GetDpi(&dpi_x, &dpi_y);
+            auto pixel = 96.0f / dpi_y;
+            return std::floor(offset / pixel + 0.5f) * pixel;
+        }
+
+    public:
+        scroll_surface()
+            : _front(0), _parent(nullptr), _generation(0),
+            _width(0), _height(0), _offset(0), _valid(false),
+            _stale_top(0), _stale_bottom(0) {}
+
+        // Forces the next render to repaint the whole viewport.  Call this
+        // whenever anything other than the scroll offset changed.
+        void invalidate() { _valid = false; }
+
+        // Repaints the content between 'top' and 'bottom', in content
+        // coordinates, on the next render, together with whatever the
+        // scrolling exposes.  Several bands merge into one covering them.
+        void invalidate(distance top, distance bottom)
+        {
+            if (top >= bottom) return;
+            if (_stale_top >= _stale_bottom)
+            {
+                _stale_top = top;
+                _stale_bottom = bottom;
+                return;
+            }
+            _stale_top = (std::min)(_stale_top, top);
+            _stale_bottom = (std::max)(_stale_bottom, bottom);
+        }
+
+        // Bytes of the two layers, at four bytes per pixel.
+        size_t memory() const
+        {
+            if (_layers[0].resource.get() == nullptr) return 0;
+            return 2 * 4 * (size_t)_width * (size_t)_height;
+        }
+
+        // The area repainted by the last render, in viewport coordinates.
+        rectangle const& dirty() const { return _dirty; }
+
+        // Paints the viewport 't' scrolled by 'offset'.  'paint' receives a
+        // target in the coordinates of 't' whose top is the top of the
+        // content, and is only expected to cover the dirty strip; drawing is
+        // clipped to it.
+        template <typename Paint>
+        void render(target const& t, distance offset, Paint paint)
+        {
+            if (empty(t)) return;
+
+            bool fresh = !_valid ||
+                _parent != t.rtarget ||
+                _generation != t.rtarget->generation() ||
+                _width != t.width() ||
+                _height != t.height();
+
+            if (fresh) create(t);
+
+            offset = snap(t, offset);
+            auto delta = offset - _offset;
+
+            auto& front = _layers[_front];
+            auto& back = _layers[1 - _front];
+            auto native = back.resource.get();
+
+            native->BeginDraw();
+            native->SetTransform(D2D1::Matrix3x2F::Identity());
+
+            if (fresh || std::fabs(delta) >= _height)
+            {
+                _dirty = rectangle(0, 0, _width, _height);
+            }
+            else
+            {
+                d2d::scoped_resource<ID2D1Bitmap> bitmap;
+                d2d::throw_call(front.resource->GetBitmap(&bitmap));
+                native->DrawBitmap(bitmap,
+                    rectangle(0, -delta, _width, _height - delta), 1.0f,
+                    D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR);
+
+                _dirty = delta > 0
+                    ? rectangle(0, _height - delta, _width, _height)
+                    : rectangle(0, 0, _width, -delta);
+
+                auto top = (std::max)(0.0f, _stale_top - offset);
+                auto bottom = (std::min)(_height, _stale_bottom - offset);
+                if (top < bottom)
+                {
+                    _dirty = empty(_dirty) ? rectangle(0, top, _width, bottom) : rectangle(
+                        0, (std::min)(_dirty.top, top), _width, (std::max)(_dirty.bottom, bottom));
+                }
+            }
+            _stale_top = _stale_bottom = 0;
+
+            if (!empty(_dirty))
+            {
+                color transparent = { 0, 0, 0, 0 };
+                native->PushAxisAlignedClip(_dirty, D2D1_ANTIALIAS_MODE_ALIASED);
+                native->Clear(transparent);
+                native->SetTransform(
+                    D2D1::Matrix3x2F::Translation(-t.left, -t.top));
+
+                target content(target(&back), rectangle(
+                    t.left, t.top - offset, t.right, t.bottom));
+                content.arena = t.arena;
+                paint(content);
+
+                back.flushed_target();
+                native->SetTransform(D2D1::Matrix3x2F::Identity());
+                native->PopAxisAlignedClip();
+            }
+
+            if (native->EndDraw() == D2DERR_RECREATE_TARGET)
+            {
+                _valid = false;
+                return;
+            }
+
+            _front = 1 - _front;
+            _offset = offset;
+            _valid = true;
+
+            d2d::scoped_resource<ID2D1Bitmap> bitmap;
+            d2d::throw_call(back.resource->GetBitmap(&bitmap));
+            t.rtarget->flushed_target()->DrawBitmap(bitmap, t, 1.0f,
+                D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR);
+        }
+    };
+}
+
+namespace ui
+{
+    // Scroll position of a view.  Wheel steps ease towards their target,
+    // drags follow the pointer directly.
+    class scroller
+    {
+        typedef frame_clock clock;
+
+        drawing::distance _offset;
+        drawing::distance _target;
+        drawing::distance _limit;
+        clock::time_point _last;
+
+        drawing::distance clamp(drawing::distance d) const
+        {
+            return (std::max)(0.0f, (std::min)(d, _limit));
+        }
+
+    public:
+        scroller() : _offset(0), _target(0), _limit(0) {}
+
+        drawing::distance offset() const { return _offset; }
+
+        bool animating() const { return _offset != _target; }
+
+        // Sets how far the content can scroll: its height less the height
+        // of the viewport showing it.
+        void set_extent(drawing::distance content, drawing::distance viewport)
+        {
+            _limit = (std::max)(0.0f, content - viewport);
+            _target = clamp(_target);
+            if (!animating()) _offset = _target;
+            else _offset = clamp(_offset);
+        }
+
+        void scroll_by(drawing::distance d)
+        {
+            if (!animating()) _last = clock::now();
+            _target = clamp(_target + d);
+        }
+
+        void scroll_to(drawing::distance d)
+        {
+            _offset = _target = clamp(d);
+        }
+
+        // Advances the animation to now.  Returns true while still moving.
+        bool update()
+        {
+            if (!animating()) return false;
+
+            auto now = clock::now();
+            std::chrono::duration<float> elapsed = now - _last;
+            _last = now;
+
+            const float time_constant = 0.05f;
+            auto remaining = _target - _offset;
+            _offset += remaining * (1 - std::exp(-elapsed.count() / time_constant));
+
+            if (std::fabs(_target - _offset) < 0.5f) _offset = _target;
+            return animating();
+        }
+    };
+}
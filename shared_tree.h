@@ -0,0 +1,334 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace model
+{
+    // One node of one version of a shared_tree.  Published nodes are never
+    // changed; versions share every subtree an edit did not touch.
+    struct frozen_node
+    {
+        // The same in every version of the node.
+        uint64_t key;
+        std::wstring name;
+        std::vector<frozen_node const*> children;
+    };
+
+    // Epoch-based reclamation of frozen nodes.  Readers hold a guard while
+    // they look at a version; a node unlinked by a writer is freed once no
+    // guard older than its unlinking remains.
+    class epoch_domain
+    {
+    public:
+        static const size_t max_guards = 64;
+
+    private:
+        struct alignas(64) slot
+        {
+            std::atomic<uint64_t> epoch;
+            std::atomic<bool> taken;
+        };
+
+        struct retired
+        {
+            uint64_t epoch;
+            frozen_node const* node;
+        };
+
+        // Starts at 1; a slot epoch of 0 means idle.
+        std::atomic<uint64_t> _epoch;
+        slot _slots[max_guards];
+
+        std::mutex _lock;
+        std::vector<retired> _retired;
+
+        epoch_domain(epoch_domain const&);
+        epoch_domain& operator=(epoch_domain const&);
+
+    public:
+        epoch_domain() : _epoch(1)
+        {
+            for (auto& s : _slots)
+            {
+                s.epoch.store(0);
+                s.taken.store(false);
+            }
+        }
+
+        ~epoch_domain()
+        {
+            for (auto& r : _retired) delete r.node;
+        }
+
+        // Pins the current epoch for as long as it lives.  Takes one of
+        // max_guards slots, waiting for one if all are taken.
+        class guard
+        {
+            slot* _slot;
+
+            guard(guard const&);
+            guard& operator=(guard const&);
+
+        public:
+            guard(epoch_domain& d) : _slot(nullptr)
+            {
+                while (_slot == nullptr)
+                {
+                    for (auto& s : d._slots)
+                    {
+                        bool free = false;
+                        if (!s.taken.load(std::memory_order_relaxed) &&
+                            s.taken.compare_exchange_strong(free, true))
+                        {
+                            _slot = &s;
+                            break;
+                        }
+                    }
+                    if (_slot == nullptr) std::this_thread::yield();
+                }
+
+                _slot->epoch.store(d._epoch.load());
+            }
+
+            ~guard()
+            {
+                _slot->epoch.store(0);
+                _slot->taken.store(false);
+            }
+        };
+
+        // Hands over nodes that the version just published no longer
+        // reaches.
+        void retire(std::vector<frozen_node const*> const& nodes)
+        {
+            if (nodes.empty()) return;
+
+            std::lock_guard<std::mutex> hold(_lock);
+            auto epoch = _epoch.fetch_add(1);
+            for (auto n : nodes)
+            {
+                retired r = { epoch, n };
+                _retired.push_back(r);
+            }
+        }
+
+        // Frees what no guard can still see; returns how many nodes.  Guards
+        // taken after the scan see at least the epoch read first, so nodes
+        // retired since then are kept too.
+        size_t collect()
+        {
+            auto oldest = _epoch.load();
+            for (auto& s : _slots)
+            {
+                auto e = s.epoch.load();
+                if (e != 0) oldest = (std::min)(oldest, e);
+            }
+
+            std::lock_guard<std::mutex> hold(_lock);
+            auto kept = std::partition(_retired.begin(), _retired.end(),
+                [oldest](retired const& r) { return r.epoch >= oldest; });
+
+            auto freed = (size_t)(_retired.end() - kept);
+            for (auto it = kept; it != _retired.end(); ++it) delete it->node;
+            _retired.erase(kept, _retired.end());
+            return freed;
+        }
+
+        // Retired nodes not yet freed.
+        size_t pending()
+        {
+            std::lock_guard<std::mutex> hold(_lock);
+            return _retired.size();
+        }
+    };
+
+    // A tree that writer threads change by publishing new versions, and
+    // that readers on any thread walk without locks.  An edit copies the
+    // path from the root to each node it changes; the rest of the tree is
+    // shared with the previous version.  Writers do not block each other
+    // either: an edit made against a version that has since been replaced
+    // is thrown away and made again on the new one.
+    class shared_tree
+    {
+        std::atomic<frozen_node const*> _root;
+        std::atomic<uint64_t> _next_key;
+        std::atomic<uint64_t> _versions;
+        epoch_domain _epochs;
+
+        shared_tree(shared_tree const&);
+        shared_tree& operator=(shared_tree const&);
+
+        static void destroy(frozen_node const* n)
+        {
+            for (auto c : n->children) destroy(c);
+            delete n;
+        }
+
+    public:
+        typedef std::vector<uint32_t> path;
+
+        shared_tree(std::wstring const& name) : _next_key(1), _versions(1)
+        {
+            auto root = new frozen_node;
+            root->key = _next_key++;
+            root->name = name;
+            _root.store(root);
+        }
+
+        ~shared_tree()
+        {
+            destroy(_root.load());
+        }
+
+        epoch_domain& epochs() { return _epochs; }
+
+        // The latest version; only safe to follow while holding a guard
+        // taken before the call.
+        frozen_node const* root() const { return _root.load(); }
+
+        // Versions published so far.
+        uint64_t versions() const { return _versions.load(); }
+
+        // Changes to one version, building the next.
+        class edit
+        {
+            shared_tree& _tree;
+            frozen_node const* _base;
+            frozen_node* _root;
+
+            // Nodes made by this edit, and nodes of the base version that
+            // the new one will not reach.
+            std::unordered_set<frozen_node const*> _made;
+            std::vector<frozen_node const*> _replaced;
+
+            edit(edit const&);
+            edit& operator=(edit const&);
+
+            frozen_node* copy(frozen_node const* n)
+            {
+                if (_made.count(n)) return const_cast<frozen_node*>(n);
+
+                auto c = new frozen_node(*n);
+                _made.insert(c);
+                _replaced.push_back(n);
+                return c;
+            }
+
+            // Copies the nodes from the root down to the one at 'p' and
+            // returns it, writable.
+            frozen_node* open(path const& p)
+            {
+                if (_root == nullptr) _root = copy(_base);
+
+                auto n = _root;
+                for (auto i : p)
+                {
+                    auto& child = n->children.at(i);
+                    auto c = copy(child);
+                    child = c;
+                    n = c;
+                }
+                return n;
+            }
+
+            // A subtree leaving the tree: nodes of the base version are
+            // retired with the edit, ones made by it are freed now.
+            void drop(frozen_node const* n)
+            {
+                for (auto c : n->children) drop(c);
+
+                if (_made.erase(n)) delete n;
+                else _replaced.push_back(n);
+            }
+
+            friend class shared_tree;
+
+        public:
+            edit(shared_tree& tree)
+                : _tree(tree), _base(tree._root.load()), _root(nullptr) {}
+
+            ~edit()
+            {
+                for (auto n : _made) delete n;
+            }
+
+            frozen_node const& root() const { return _root ? *_root : *_base; }
+
+            frozen_node const* find(path const& p) const
+            {
+                auto n = &root();
+                for (auto i : p)
+                {
+                    if (i >= n->children.size()) return nullptr;
+                    n = n->children[i];
+                }
+                return n;
+            }
+
+            void insert(path const& parent, size_t index, std::wstring const& name)
+            {
+                auto n = new frozen_node;
+                n->key = _tree._next_key++;
+                n->name = name;
+                _made.insert(n);
+
+                auto p = open(parent);
+                index = (std::min)(index, p->children.size());
+                p->children.insert(p->children.begin() + index, n);
+            }
+
+            void append(path const& parent, std::wstring const& name)
+            {
+                insert(parent, ~(size_t)0, name);
+            }
+
+            void remove(path const& parent, size_t index)
+            {
+                auto p = open(parent);
+                auto child = p->children.at(index);
+                p->children.erase(p->children.begin() + index);
+                drop(child);
+            }
+
+            void rename(path const& p, std::wstring const& name)
+            {
+                open(p)->name = name;
+            }
+        };
+
+        // Runs f(edit&) on the latest version and publishes the result.  If
+        // another writer published first, the edit is discarded and f runs
+        // again on the newer version, so f must only depend on what it
+        // reads through the edit.
+        template <typename F>
+        void write(F f)
+        {
+            for (;;)
+            {
+                epoch_domain::guard g(_epochs);
+                edit e(*this);
+                f(e);
+
+                if (e._root == nullptr) return;
+
+                auto expected = e._base;
+                if (_root.compare_exchange_strong(expected, e._root))
+                {
+                    e._made.clear();
+                    _versions++;
+                    _epochs.retire(e._replaced);
+                    break;
+                }
+            }
+            _epochs.collect();
+        }
+    };
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace snapshot
+{
+    // Binary tree snapshot.  The file is mapped read-only and nodes are read
+    // in place, so showing a snapshot costs the same for ten nodes as for
+    // ten million; only verification, on by default, reads the whole file
+    // once when it is opened.  Layout:
+    //
+    //   header
+    //   record[node_count]         breadth-first, so siblings are contiguous
+    //   wchar_t[string_length]     names, not null-terminated
+    //
+    // The checksum is a CRC-32 of everything following the header.
+
+    const uint32_t magic = 0x45455254; // "TREE"
+    const uint32_t version = 1;
+
+    enum flags : uint32_t
+    {
+        expanded = 1
+    };
+
+    struct header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t node_count;
+        uint32_t string_length;
+        uint32_t checksum;
+        uint32_t reserved;
+    };
+
+    struct record
+    {
+        uint32_t first_child;
+        uint32_t child_count;
+        uint32_t name_offset;
+        uint32_t name_length;
+        uint32_t flags;
+    };
+
+    static_assert(sizeof(wchar_t) == 2, "snapshot strings are UTF-16");
+
+    class snapshot_exception : public std::exception
+    {
+        char const* _reason;
+
+    public:
+        snapshot_exception(char const* reason) : _reason(reason) {}
+
+        char const* what() const throw() override { return _reason; }
+    };
+
+    class crc32
+    {
+        uint32_t _table[256];
+        uint32_t _value;
+
+    public:
+        crc32() : _value(0xffffffff)
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                _table[i] = c;
+            }
+        }
+
+        void update(void const* data, size_t length)
+        {
+            auto p = static_cast<uint8_t const*>(data);
+            for (size_t i = 0; i < length; i++)
+                _value = _table[(_value ^ p[i]) & 0xff] ^ (_value >> 8);
+        }
+
+        uint32_t value() const { return _value ^ 0xffffffff; }
+    };
+
+    class mapped_file
+    {
+        HANDLE _file;
+        HANDLE _mapping;
+        void const* _view;
+        uint64_t _size;
+
+        mapped_file(mapped_file const&);
+        mapped_file& operator=(mapped_file const&);
+
+    public:
+        mapped_file(std::wstring const& path)
+            : _file(INVALID_HANDLE_VALUE), _mapping(NULL), _view(nullptr), _size(0)
+        {
+            _file = ::CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (_file == INVALID_HANDLE_VALUE)
+                throw snapshot_exception("cannot open snapshot");
+
+            LARGE_INTEGER size;
+            if (!::GetFileSizeEx(_file, &size) || size.QuadPart == 0)
+            {
+                close();
+                throw snapshot_exception("empty snapshot");
+            }
+            _size = size.QuadPart;
+
+            _mapping = ::CreateFileMapping(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (_mapping != NULL)
+                _view = ::MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+
+            if (_view == nullptr)
+            {
+                close();
+                throw snapshot_exception("cannot map snapshot");
+            }
+        }
+
+        ~mapped_file()
+        {
+            close();
+        }
+
+        void close()
+        {
+            if (_view != nullptr) ::UnmapViewOfFile(_view);
+            if (_mapping != NULL) ::CloseHandle(_mapping);
+            if (_file != INVALID_HANDLE_VALUE) ::CloseHandle(_file);
+            _view = nullptr;
+            _mapping = NULL;
+            _file = INVALID_HANDLE_VALUE;
+        }
+
+        void const* data() const { return _view; }
+        uint64_t size() const { return _size; }
+    };
+
+    class file
+    {
+        mapped_file _map;
+        header const* _header;
+        record const* _records;
+        wchar_t const* _strings;
+
+    public:
+        // Verification walks the whole file once (checksum and bounds) but
+        // allocates nothing; pass verify = false for trusted files.
+        file(std::wstring const& path, bool verify = true) : _map(path)
+        {
+            if (_map.size() < sizeof(header))
+                throw snapshot_exception("truncated snapshot");
+
+            _header = static_cast<header const*>(_map.data());
+            if (_header->magic != magic)
+                throw snapshot_exception("not a snapshot");
+            if (_header->version != version)
+                throw snapshot_exception("unsupported snapshot version");
+
+            uint64_t expected = sizeof(header) +
+                uint64_t(_header->node_count) * sizeof(record) +
+                uint64_t(_header->string_length) * sizeof(wchar_t);
+            if (_map.size() != expected || _header->node_count == 0)
+                throw snapshot_exception("truncated snapshot");
+
+            _records = reinterpret_cast<record const*>(_header + 1);
+            _strings = reinterpret_cast<wchar_t const*>(_records + _header->node_count);
+
+            if (verify)
+            {
+                crc32 crc;
+                crc.update(_records, size_t(_map.size() - sizeof(header)));
+                if (crc.value() != _header->checksum)
+                    throw snapshot_exception("snapshot checksum mismatch");
+
+                for (uint32_t i = 0; i < _header->node_count; i++)
+                {
+                    auto& r = _records[i];
+                    if (uint64_t(r.first_child) + r.child_count > _header->node_count ||
+                        (r.child_count != 0 && r.first_child <= i) ||
+                        uint64_t(r.name_offset) + r.name_length > _header->string_length)
+                        throw snapshot_exception("corrupt snapshot");
+                }
+            }
+        }
+
+        uint32_t size() const { return _header->node_count; }
+
+        uint32_t root() const { return 0; }
+
+        record const& at(uint32_t i) const { return _records[i]; }
+
+        std::wstring name(uint32_t i) const
+        {
+            auto& r = _records[i];
+            return std::wstring(_strings + r.name_offset, r.name_length);
+        }
+
+        bool is_expanded(uint32_t i) const
+        {
+            return (_records[i].flags & expanded) != 0;
+        }
+    };
+
+    // Writes any tree whose nodes expose 'name', an iterable 'children' and
+    // 'is_expanded()'.
+    template <typename Node>
+    void write(std::wstring const& path, Node const& root)
+    {
+        std::vector<record> records;
+        std::wstring strings;
+        std::deque<Node const*> queue;
+
+        queue.push_back(&root);
+        uint32_t next = 1;
+
+        while (!queue.empty())
+        {
+            auto n = queue.front();
+            queue.pop_front();
+
+            record r;
+            r.first_child = next;
+            r.child_count = 0;
+            r.name_offset = (uint32_t)strings.length();
+            r.name_length = (uint32_t)n->name.length();
+            r.flags = n->is_expanded() ? expanded : 0;
+
+            for (auto& c : n->children)
+            {
+                queue.push_back(&c);
+                r.child_count++;
+            }
+            if (r.child_count == 0) r.first_child = 0;
+
+            next += r.child_count;
+            strings += n->name;
+            records.push_back(r);
+        }
+
+        header h;
+        h.magic = magic;
+        h.version = version;
+        h.node_count = (uint32_t)records.size();
+        h.string_length = (uint32_t)strings.length();
+        h.reserved = 0;
+
+        crc32 crc;
+        crc.update(records.data(), records.size() * sizeof(record));
+        crc.update(strings.data(), strings.length() * sizeof(wchar_t));
+        h.checksum = crc.value();
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<char const*>(&h), sizeof(h));
+        out.write(reinterpret_cast<char const*>(records.data()),
+            records.size() * sizeof(record));
+        out.write(reinterpret_cast<char const*>(strings.data()),
+            strings.length() * sizeof(wchar_t));
+        if (!out) throw snapshot_exception("cannot write snapshot");
+    }
+}
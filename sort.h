@@ -0,0 +1,337 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <locale>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "model.h"
+#include "pool.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#endif
+
+namespace model
+{
+    // Bytes that compare, as plain bytes, the way 'name' compares under the
+    // user's locale, so a sort does the expensive locale work once per name
+    // instead of once per comparison.
+    std::string collation_key(std::wstring const& name)
+    {
+#ifdef _WIN32
+        auto flags = LCMAP_SORTKEY | NORM_IGNORECASE | SORT_DIGITSASNUMBERS;
+        auto size = LCMapStringEx(LOCALE_NAME_USER_DEFAULT, flags,
+            name.c_str(), (int)name.size(), nullptr, 0, nullptr, nullptr, 0);
+
+        std::string key(size, 0);
+        LCMapStringEx(LOCALE_NAME_USER_DEFAULT, flags, name.c_str(), (int)name.size(),
+            reinterpret_cast<LPWSTR>(&key[0]), size, nullptr, nullptr, 0);
+
+        // Drop the terminating null.
+        if (!key.empty()) key.pop_back();
+        return key;
+#else
+        auto& collate = std::use_facet<std::collate<wchar_t> >(std::locale());
+        auto wide = collate.transform(name.data(), name.data() + name.size());
+
+        // Weights are written UTF-8 style, which keeps their order bytewise
+        // and the common ones short; larger ones after a 0xff byte.
+        std::string key;
+        key.reserve(wide.size());
+        for (auto c : wide)
+        {
+            auto u = (uint32_t)c;
+            if (u < 0x80) key += (char)u;
+            else if (u < 0x800)
+            {
+                key += (char)(0xc0 | (u >> 6));
+                key += (char)(0x80 | (u & 0x3f));
+            }
+            else if (u < 0x10000)
+            {
+                key += (char)(0xe0 | (u >> 12));
+                key += (char)(0x80 | ((u >> 6) & 0x3f));
+                key += (char)(0x80 | (u & 0x3f));
+            }
+            else
+            {
+                key += (char)0xff;
+                key += (char)(u >> 24);
+                key += (char)(u >> 16);
+                key += (char)(u >> 8);
+                key += (char)u;
+            }
+        }
+        return key;
+#endif
+    }
+
+    // Sorted views of the children of nodes.  Node storage is never
+    // reordered: each parent gets a permutation of its children, made the
+    // first time it is asked for and kept up to date from the model's
+    // change lists, with inserted nodes merged into place.  Collation keys
+    // of names are cached by node id, so sorting again by another column
+    // or direction costs only the sort.
+    class tree_sort
+    {
+    public:
+        // Sort key of the numeric columns.
+        typedef std::function<int64_t(node const&)> number_key;
+
+    private:
+        bool _active;
+        bool _descending;
+        number_key _number;
+
+        std::vector<std::string> _keys;
+        std::vector<uint8_t> _keyed;
+        std::unordered_map<node const*, std::vector<node*> > _orders;
+
+        parallel::thread_pool& _pool;
+
+        // Largest sibling set sorted without the pool.
+        static const size_t grain = 16 * 1024;
+
+        std::string const& key(node const& n) const { return _keys[n.id]; }
+
+        // Computes missing keys of 'nodes', in parallel for large sets.
+        void make_keys(std::vector<node*> const& nodes)
+        {
+            if (!_number) key_names(nodes);
+        }
+
+        void key_names(std::vector<node*> const& nodes)
+        {
+            uint32_t limit = 0;
+            for (auto n : nodes) limit = (std::max)(limit, n->id + 1);
+            if (_keys.size() < limit)
+            {
+                _keys.resize(limit);
+                _keyed.resize(limit);
+            }
+
+            parallel::for_each_slice(_pool, nodes.size(), grain / 4, [&](size_t begin, size_t end)
+            {
+                for (auto i = begin; i < end; i++)
+                {
+                    auto n = nodes[i];
+                    if (_keyed[n->id]) continue;
+                    _keys[n->id] = collation_key(n->name);
+                    _keyed[n->id] = 1;
+                }
+            });
+        }
+
+        // Sort entries carry the leading bytes of the key, which settle
+        // most comparisons without touching the node or the key cache.
+        struct entry
+        {
+            uint64_t prefix;
+            node* n;
+        };
+
+        entry make_entry(node* n) const
+        {
+            entry e = { 0, n };
+            if (_number)
+            {
+                e.prefix = (uint64_t)_number(*n) ^ (1ull << 63);
+            }
+            else
+            {
+                auto& k = key(*n);
+                for (size_t i = 0; i < 8; i++)
+                    e.prefix = (e.prefix << 8) | (i < k.size() ? (uint8_t)k[i] : 0);
+            }
+            return e;
+        }
+
+        // Strict ascending order; ties go by id, so inserts merge to the
+        // same place a full sort would put them.
+        bool ascending(entry const& a, entry const& b) const
+        {
+            if (a.prefix != b.prefix) return a.prefix < b.prefix;
+
+            if (!_number)
+            {
+                auto c = key(*a.n).compare(key(*b.n));
+                if (c != 0) return c < 0;
+            }
+            return a.n->id < b.n->id;
+        }
+
+        bool less(entry const& a, entry const& b) const
+        {
+            return _descending ? ascending(b, a) : ascending(a, b);
+        }
+
+        bool less(node* a, node* b) const
+        {
+            return less(make_entry(a), make_entry(b));
+        }
+
+        void sort(std::vector<node*>& order)
+        {
+            make_keys(order);
+
+            std::vector<entry> entries(order.size());
+            parallel::for_each_slice(_pool, order.size(), grain, [&](size_t begin, size_t end)
+            {
+                for (auto i = begin; i < end; i++) entries[i] = make_entry(order[i]);
+            });
+
+            parallel::sort(_pool, entries, [this](entry const& a, entry const& b)
+            {
+                return less(a, b);
+            }, grain);
+
+            for (size_t i = 0; i < entries.size(); i++) order[i] = entries[i].n;
+        }
+
+        // Sorts the nodes first..last (inclusive) and merges them into the
+        // order of their parent, if it has one.
+        void merge(node& parent, node::iterator first, node::iterator last)
+        {
+            auto found = _orders.find(&parent);
+            if (found == _orders.end()) return;
+
+            std::vector<node*> added;
+            for (auto it = first;; ++it)
+            {
+                added.push_back(&*it);
+                if (it == last) break;
+            }
+            sort(added);
+
+            auto& order = found->second;
+            auto middle = order.size();
+            order.insert(order.end(), added.begin(), added.end());
+            std::inplace_merge(order.begin(), order.begin() + middle, order.end(),
+                [this](node* a, node* b) { return less(a, b); });
+        }
+
+        // Drops the orders of 'n' and its descendants, whose addresses may
+        // be reused once they are freed.
+        void forget(node const& n)
+        {
+            _orders.erase(&n);
+            for (auto& c : n.children) forget(c);
+        }
+
+    public:
+        tree_sort(parallel::thread_pool& pool = parallel::thread_pool::instance())
+            : _active(false), _descending(false), _pool(pool) {}
+
+        bool active() const { return _active; }
+        bool descending() const { return _descending; }
+
+        // Computes the collation keys of 'nodes' ahead of any sort by name,
+        // so that sort does not have to.
+        void prepare_keys(std::vector<node*> const& nodes)
+        {
+            key_names(nodes);
+        }
+
+        // Sorts by name under the user's locale.
+        void by_name(bool descending)
+        {
+            _active = true;
+            _descending = descending;
+            _number = number_key();
+            _orders.clear();
+        }
+
+        void by_number(number_key key, bool descending)
+        {
+            _active = true;
+            _descending = descending;
+            _number = key;
+            _orders.clear();
+        }
+
+        // Flips the direction; the orders made so far are reversed rather
+        // than sorted again.
+        void reverse()
+        {
+            _descending = !_descending;
+            for (auto& o : _orders) std::reverse(o.second.begin(), o.second.end());
+        }
+
+        // Back to the model's own order.
+        void clear()
+        {
+            _active = false;
+            _orders.clear();
+        }
+
+        // Children of 'parent' in sorted order.  Lazily loaded children
+        // arrive without a change, so an order that lost count of them is
+        // made again.
+        std::vector<node*> const& children(node& parent)
+        {
+            auto& order = _orders[&parent];
+            if (order.size() != parent.children.size())
+            {
+                order.clear();
+                order.reserve(parent.children.size());
+                for (auto& c : parent.children) order.push_back(&c);
+                sort(order);
+            }
+            return order;
+        }
+
+        // Keeps the orders in step with edits to the model.
+        void update(change_list const& changes)
+        {
+            if (!_active) return;
+
+            for (auto& c : changes)
+            {
+                switch (c.kind)
+                {
+                case change::insert:
+                    merge(*c.parent, c.first, c.last);
+                    break;
+
+                case change::remove:
+                {
+                    std::unordered_set<node const*> removed;
+                    for (auto it = c.first;; ++it)
+                    {
+                        removed.insert(&*it);
+                        forget(*it);
+                        if (it == c.last) break;
+                    }
+
+                    auto found = _orders.find(c.parent);
+                    if (found != _orders.end())
+                    {
+                        auto& order = found->second;
+                        order.erase(std::remove_if(order.begin(), order.end(),
+                            [&](node* n) { return removed.count(n) != 0; }), order.end());
+                    }
+                    break;
+                }
+
+                case change::move:
+                    _orders.erase(c.parent);
+                    _orders.erase(c.target);
+                    break;
+
+                case change::rename:
+                    if (c.target->id < _keyed.size()) _keyed[c.target->id] = 0;
+                    _orders.erase(c.parent);
+                    break;
+
+                case change::expand:
+                    break;
+                }
+            }
+        }
+    };
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+#include "profile.h"
+
+namespace diagnostics
+{
+    // When each step of starting the application ran, measured from the
+    // start of main.  Steps may run on several threads at once; they also
+    // appear as zones in exported traces.
+    class startup_timeline
+    {
+    public:
+        typedef std::chrono::steady_clock clock;
+
+        struct phase
+        {
+            char const* name;
+            clock::duration begin;
+            clock::duration end;
+            bool background;  // off the UI thread
+        };
+
+    private:
+        clock::time_point _start;
+        std::thread::id _ui;
+
+        std::mutex _lock;
+        std::vector<phase> _phases;
+
+        startup_timeline(startup_timeline const&);
+        startup_timeline& operator=(startup_timeline const&);
+
+    public:
+        // Starts the clock; the calling thread counts as the UI thread.
+        startup_timeline()
+            : _start(clock::now()), _ui(std::this_thread::get_id()) {}
+
+        clock::time_point start() const { return _start; }
+
+        void record(char const* name, clock::time_point begin, clock::time_point end)
+        {
+            phase p = { name, begin - _start, end - _start,
+                std::this_thread::get_id() != _ui };
+
+            std::lock_guard<std::mutex> hold(_lock);
+            _phases.push_back(p);
+        }
+
+        // A moment rather than a step, such as the first frame.
+        void mark(char const* name)
+        {
+            auto now = clock::now();
+            record(name, now, now);
+        }
+
+        // Times one step until it goes out of scope.  Names must be string
+        // literals.
+        class scope
+        {
+            startup_timeline& _timeline;
+            char const* _name;
+            clock::time_point _begin;
+            zone _zone;
+
+            scope(scope const&);
+            scope& operator=(scope const&);
+
+        public:
+            scope(startup_timeline& timeline, char const* name)
+                : _timeline(timeline), _name(name), _begin(clock::now()), _zone(name) {}
+
+            ~scope()
+            {
+                _timeline.record(_name, _begin, clock::now());
+            }
+        };
+
+        // One line per step in the order they finished: when it started and
+        // how long it took, in milliseconds, with background steps marked.
+        void write(std::ostream& out)
+        {
+            std::lock_guard<std::mutex> hold(_lock);
+
+            char line[128];
+            for (auto& p : _phases)
+            {
+                auto begin = std::chrono::duration<double, std::milli>(p.begin).count();
+                auto took = std::chrono::duration<double, std::milli>(p.end - p.begin).count();
+                snprintf(line, sizeof(line), "%8.1f ms %+8.1f ms  %s%s\n",
+                    begin, took, p.name, p.background ? " (background)" : "");
+                out << line;
+            }
+        }
+    };
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ui
+{
+    // Stable identity of a widget, derived from a key for what it shows and
+    // an optional part number for widgets with several stateful parts.
+    // Keys the model never reuses, such as node ids, are safer than
+    // addresses, which a new object may take over while an entry for the
+    // old one is still in a table.
+    inline uint64_t widget_id(uint64_t key, uint32_t part = 0)
+    {
+        uint64_t x = key ^ ((uint64_t)part << 48);
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        x ^= x >> 31;
+        return x;
+    }
+
+    inline uint64_t widget_id(void const* p, uint32_t part = 0)
+    {
+        return widget_id((uint64_t)(uintptr_t)p, part);
+    }
+
+    // Transient widget state (hover, animation) looked up by widget id while
+    // rendering, so the model only holds what it owns.  Entries sit in an
+    // open-addressing table with linear probing; an entry that has not been
+    // looked up for 'max_age' frames is dropped.  Lookups are O(1) and only
+    // allocate when the table grows.
+    template <typename State>
+    class state_table
+    {
+        struct slot
+        {
+            uint64_t id;
+            uint32_t seen;
+            bool used;
+            State state;
+
+            slot() : id(0), seen(0), used(false) {}
+        };
+
+        std::vector<slot> _slots;
+        size_t _count;
+        size_t _sweep;
+        uint32_t _frame;
+        uint32_t _max_age;
+
+        size_t mask() const { return _slots.size() - 1; }
+
+        size_t find_slot(uint64_t id) const
+        {
+            auto i = (size_t)id & mask();
+            while (_slots[i].used && _slots[i].id != id)
+                i = (i + 1) & mask();
+            return i;
+        }
+
+        void grow()
+        {
+            std::vector<slot> old(_slots.size() * 2);
+            old.swap(_slots);
+
+            for (auto& s : old)
+                if (s.used) _slots[find_slot(s.id)] = s;
+        }
+
+        // Backward-shift deletion: later entries of the probe run move up so
+        // no tombstones are needed.
+        void erase(size_t i)
+        {
+            _slots[i].used = false;
+            _count--;
+
+            for (auto j = (i + 1) & mask(); _slots[j].used; j = (j + 1) & mask())
+            {
+                auto home = (size_t)_slots[j].id & mask();
+                if (((j - home) & mask()) >= ((j - i) & mask()))
+                {
+                    _slots[i] = _slots[j];
+                    _slots[j].used = false;
+                    i = j;
+                }
+            }
+        }
+
+    public:
+        state_table(uint32_t max_age = 60, size_t capacity = 64)
+            : _count(0), _sweep(0), _frame(0), _max_age(max_age)
+        {
+            size_t size = 16;
+            while (size < capacity) size *= 2;
+            _slots.resize(size);
+        }
+
+        // Starts a frame.  Stale entries are swept a slice at a time, so
+        // every slot is visited once per 'max_age' frames.
+        void next_frame()
+        {
+            _frame++;
+
+            auto slice = _slots.size() / _max_age + 1;
+            for (size_t n = 0; n < slice; n++)
+            {
+                auto& s = _slots[_sweep];
+                if (s.used && _frame - s.seen > _max_age)
+                    erase(_sweep);
+                else
+                    _sweep = (_sweep + 1) & mask();
+            }
+        }
+
+        // Bytes held by the table itself, not counting what states own.
+        size_t memory() const { return _slots.capacity() * sizeof(slot); }
+
+        // State of 'id', created from 'initial' if the widget has none.
+        State& get(uint64_t id, State const& initial = State())
+        {
+            auto i = find_slot(id);
+            if (!_slots[i].used)
+            {
+                if ((_count + 1) * 4 > _slots.size() * 3)
+                {
+                    grow();
+                    i = find_slot(id);
+                }
+
+                _slots[i].used = true;
+                _slots[i].id = id;
+                _slots[i].state = initial;
+                _count++;
+            }
+
+            _slots[i].seen = _frame;
+            return _slots[i].state;
+        }
+
+        // Drops the state of 'id', if any, before it would age out.
+        void remove(uint64_t id)
+        {
+            auto i = find_slot(id);
+            if (_slots[i].used) erase(i);
+        }
+
+        // State of 'id' if it has any.  Does not count as a use.
+        State* find(uint64_t id)
+        {
+            auto i = find_slot(id);
+            return _slots[i].used ? &_slots[i].state : nullptr;
+        }
+
+        size_t size() const { return _count; }
+        uint32_t frame() const { return _frame; }
+    };
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "geometry.h"
+
+namespace ui
+{
+    // Values of one table column, stored contiguously and indexed by row
+    // key.  Rows without a value read as nullptr.
+    template <typename T>
+    class column_data
+    {
+        std::vector<T> _values;
+        std::vector<bool> _present;
+
+    public:
+        void set(uint32_t key, T const& value)
+        {
+            if (key >= _values.size())
+            {
+                _values.resize(key + 1);
+                _present.resize(key + 1);
+            }
+
+            _values[key] = value;
+            _present[key] = true;
+        }
+
+        T const* find(uint32_t key) const
+        {
+            return key < _values.size() && _present[key] ? &_values[key] : nullptr;
+        }
+
+        size_t size() const { return _values.size(); }
+
+        void reserve(size_t n)
+        {
+            _values.reserve(n);
+            _present.reserve(n);
+        }
+    };
+
+    // One column of a tree-table.  Column 0 holds the tree itself; the
+    // others produce their cell text on demand through 'format', so only
+    // rows that get painted are ever fetched.  'generation' changes when the
+    // column's data does, which tells cell caches to format again.
+    struct table_column
+    {
+        std::wstring title;
+        drawing::distance left;
+        drawing::distance width;
+        bool align_right;
+        uint32_t generation;
+        std::function<bool(uint32_t key, std::wstring& text)> format;
+    };
+
+    // Horizontal layout of a tree-table's columns, left to right.  It is
+    // independent of the row layout: resizing a column moves the columns
+    // after it and leaves the rows alone.
+    class table_columns
+    {
+        std::vector<table_column> _columns;
+
+    public:
+        static const size_t none = size_t(-1);
+
+        // Width columns cannot be resized below.
+        static const int min_width = 20;
+
+        table_columns(std::wstring const& tree_title, drawing::distance tree_width)
+        {
+            table_column c;
+            c.title = tree_title;
+            c.left = 0;
+            c.width = tree_width;
+            c.align_right = false;
+            c.generation = 0;
+            _columns.push_back(c);
+        }
+
+        size_t add(std::wstring const& title, drawing::distance width, bool align_right,
+            std::function<bool(uint32_t, std::wstring&)> format)
+        {
+            table_column c;
+            c.title = title;
+            c.left = right();
+            c.width = width;
+            c.align_right = align_right;
+            c.generation = 0;
+            c.format = format;
+            _columns.push_back(c);
+            return _columns.size() - 1;
+        }
+
+        size_t size() const { return _columns.size(); }
+
+        table_column const& at(size_t c) const { return _columns[c]; }
+
+        // Right edge of the last column.
+        drawing::distance right() const
+        {
+            auto& last = _columns.back();
+            return last.left + last.width;
+        }
+
+        // Cells of column 'c' have to be formatted again.
+        void changed(size_t c)
+        {
+            _columns[c].generation++;
+        }
+
+        void resize(size_t c, drawing::distance width)
+        {
+            width = (std::max)(width, (drawing::distance)min_width);
+
+            auto delta = width - _columns[c].width;
+            _columns[c].width = width;
+
+            for (auto i = c + 1; i < _columns.size(); i++)
+                _columns[i].left += delta;
+        }
+
+        // Part of 'row' in column 'c'.
+        drawing::rectangle cell(drawing::rectangle const& row, size_t c) const
+        {
+            auto& col = _columns[c];
+            return drawing::rectangle(
+                (std::max)(row.left, col.left), row.top,
+                col.left + col.width, row.bottom);
+        }
+
+        // Column whose right edge is within 'slop' of 'x', or none.
+        size_t divider_at(drawing::distance x, drawing::distance slop) const
+        {
+            for (size_t c = 0; c < _columns.size(); c++)
+            {
+                auto edge = _columns[c].left + _columns[c].width;
+                if (x >= edge - slop && x <= edge + slop) return c;
+            }
+            return none;
+        }
+
+        // Column containing 'x', or none.
+        size_t column_at(drawing::distance x) const
+        {
+            for (size_t c = 0; c < _columns.size(); c++)
+            {
+                if (x >= _columns[c].left && x < _columns[c].left + _columns[c].width)
+                    return c;
+            }
+            return none;
+        }
+    };
+}
@@ -11,10 +11,13 @@ namespace drawing
     {
         d2d::render_target* rtarget;
 
-        target() : rtarget(nullptr), rectangle(0, 0, 0, 0)
+        // Scratch memory for the frame being drawn; may be null.
+        frame_arena* arena;
+
+        target() : rtarget(nullptr), arena(nullptr), rectangle(0, 0, 0, 0)
         {}
 
-        target(d2d::render_target* rt) : rtarget(rt)
+        target(d2d::render_target* rt) : rtarget(rt), arena(rt->arena())
         {
             auto size = rt->get_target()->GetSize();
             top = 0;
@@ -24,7 +27,7 @@ namespace drawing
         }
 
         target(target const& t, rectangle const& r)
-            : rtarget(t.rtarget), rectangle(r) {}
+            : rtarget(t.rtarget), arena(t.arena), rectangle(r) {}
 
         rectangle& bounds() { return *this; }
         rectangle const& bounds() const { return *this; }
@@ -1,9 +1,19 @@
 #pragma once
 
 #include <dwrite.h>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
+#include "atlas.h"
 #include "com.h"
 #include "geometry.h"
+#include "profile.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TEXT_SSE2
+#endif
 
 namespace text
 {
@@ -44,13 +54,15 @@ namespace text
         com::com_ptr<IDWriteTextLayout> ptr;
 
         layout(factory& f, 
-            const std::wstring& string, 
+            std::wstring_view string, 
             format& textFormat, 
             drawing::distance maxWidth, 
             drawing::distance maxHeight)
         {
+            TRACE_ZONE("text::layout");
+
             com::throw_call(f.ptr->CreateTextLayout(
-                string.c_str(), string.length(), textFormat.ptr, maxWidth, maxHeight, &ptr));
+                string.data(), (UINT32)string.length(), textFormat.ptr, maxWidth, maxHeight, &ptr));
         }
     };
 
@@ -64,4 +76,333 @@ namespace text
                 textFormat.ptr, &ptr));
         }
     };
-}
\ No newline at end of file
+
+    // Glyphs for one label, ready to be drawn as a single glyph run.  Keep
+    // one around and reuse it; its buffers only grow.
+    struct glyph_run
+    {
+        std::vector<UINT16> indices;
+        std::vector<FLOAT> advances;
+        drawing::distance width;
+        bool trimmed;
+
+        glyph_run() : width(0), trimmed(false) {}
+    };
+
+    // Glyph indices and advances of a format's font, cached per UTF-16 code
+    // unit.  Labels in scripts that need no shaping are measured and trimmed
+    // from these tables without creating a text layout; everything else is
+    // rejected so the caller can fall back to one.
+    class glyph_cache
+    {
+        // Code units below this are cached, in pages of 256.
+        static const UINT32 cached_limit = 0x600;
+        static const wchar_t ellipsis = 0x2026;
+
+        struct page
+        {
+            UINT16 indices[256];
+            FLOAT advances[256];
+        };
+
+        com::com_ptr<IDWriteFontFace> _face;
+        FLOAT _size;
+        FLOAT _scale;
+        drawing::distance _ascent;
+        drawing::distance _height;
+        UINT16 _ellipsis_index;
+        FLOAT _ellipsis_advance;
+        std::unique_ptr<page> _pages[cached_limit / 256];
+
+        glyph_cache(glyph_cache const&);
+        glyph_cache& operator=(glyph_cache const&);
+
+        void lookup(UINT32 const* code_points, UINT32 count,
+            UINT16* indices, FLOAT* advances)
+        {
+            std::vector<DWRITE_GLYPH_METRICS> metrics(count);
+            com::throw_call(_face->GetGlyphIndices(code_points, count, indices));
+            com::throw_call(_face->GetDesignGlyphMetrics(
+                indices, count, metrics.data()));
+
+            for (UINT32 i = 0; i < count; i++)
+                advances[i] = metrics[i].advanceWidth * _scale;
+        }
+
+        page const& page_of(wchar_t c)
+        {
+            auto& p = _pages[c >> 8];
+            if (!p)
+            {
+                std::unique_ptr<page> loaded(new page);
+                UINT32 code_points[256];
+                for (UINT32 i = 0; i < 256; i++)
+                    code_points[i] = (c & 0xff00) + i;
+                lookup(code_points, 256, loaded->indices, loaded->advances);
+                p = std::move(loaded);
+            }
+            return *p;
+        }
+
+        // Latin, Greek, Cyrillic and Armenian without combining marks; no
+        // controls (C0, DEL or C1), bidi or surrogates.  The Cyrillic
+        // combining marks are U+0483 to U+0489.
+        static bool simple(wchar_t c)
+        {
+            return (c >= 0x20 && c < 0x7f) || (c >= 0xa0 && c < 0x300) ||
+                (c >= 0x370 && c < 0x483) || (c >= 0x48a && c < 0x590);
+        }
+
+#ifdef TEXT_SSE2
+        // Lanes of 'c' in [first, last].
+        static __m128i in_range(__m128i c, int first, int last)
+        {
+            return _mm_cmpeq_epi16(_mm_setzero_si128(), _mm_subs_epu16(
+                _mm_sub_epi16(c, _mm_set1_epi16((short)first)),
+                _mm_set1_epi16((short)(last - first))));
+        }
+#endif
+
+        static bool simple(std::wstring_view s)
+        {
+            size_t i = 0;
+#ifdef TEXT_SSE2
+            for (; i + 8 <= s.length(); i += 8)
+            {
+                auto c = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s.data() + i));
+                auto ok = _mm_or_si128(
+                    _mm_or_si128(in_range(c, 0x20, 0x7e), in_range(c, 0xa0, 0x2ff)),
+                    _mm_or_si128(in_range(c, 0x370, 0x482), in_range(c, 0x48a, 0x58f)));
+                if (_mm_movemask_epi8(ok) != 0xffff)
+                    return false;
+            }
+#endif
+            for (; i < s.length(); i++)
+                if (!simple(s[i])) return false;
+            return true;
+        }
+
+        // Number of leading advances whose sum stays within 'limit'; their
+        // sum is added to 'width'.
+        static size_t fit(FLOAT const* advances, size_t count,
+            drawing::distance limit, drawing::distance& width)
+        {
+            size_t i = 0;
+            FLOAT total = 0;
+#ifdef TEXT_SSE2
+            const __m128 bound = _mm_set1_ps(limit);
+
+            for (; i + 4 <= count; i += 4)
+            {
+                // Inclusive prefix sum of four advances, offset by the
+                // running total.
+                auto a = _mm_loadu_ps(advances + i);
+                a = _mm_add_ps(a, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(a), 4)));
+                a = _mm_add_ps(a, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(a), 8)));
+                a = _mm_add_ps(a, _mm_set1_ps(total));
+
+                if (_mm_movemask_ps(_mm_cmpgt_ps(a, bound)) != 0)
+                    break;
+
+                total = _mm_cvtss_f32(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 3, 3)));
+            }
+#endif
+            for (; i < count && total + advances[i] <= limit; i++)
+                total += advances[i];
+
+            width += total;
+            return i;
+        }
+
+    public:
+        glyph_cache(factory& f, format& textFormat)
+        {
+            com::com_ptr<IDWriteFontCollection> fonts;
+            com::throw_call(textFormat.ptr->GetFontCollection(&fonts));
+            if (fonts.get() == nullptr)
+            {
+                fonts.release();
+                com::throw_call(f.ptr->GetSystemFontCollection(&fonts));
+            }
+
+            std::vector<WCHAR> family_name(
+                textFormat.ptr->GetFontFamilyNameLength() + 1);
+            com::throw_call(textFormat.ptr->GetFontFamilyName(
+                family_name.data(), (UINT32)family_name.size()));
+
+            UINT32 family_index;
+            BOOL exists;
+            com::throw_call(fonts->FindFamilyName(
+                family_name.data(), &family_index, &exists));
+            if (!exists) com::throw_call(E_FAIL);
+
+            com::com_ptr<IDWriteFontFamily> family;
+            com::throw_call(fonts->GetFontFamily(family_index, &family));
+
+            com::com_ptr<IDWriteFont> font;
+            com::throw_call(family->GetFirstMatchingFont(
+                textFormat.ptr->GetFontWeight(),
+                textFormat.ptr->GetFontStretch(),
+                textFormat.ptr->GetFontStyle(),
+                &font));
+            com::throw_call(font->CreateFontFace(&_face));
+
+            DWRITE_FONT_METRICS metrics;
+            _face->GetMetrics(&metrics);
+
+            _size = textFormat.ptr->GetFontSize();
+            _scale = _size / metrics.designUnitsPerEm;
+            _ascent = metrics.ascent * _scale;
+            _height = (metrics.ascent + metrics.descent + metrics.lineGap) * _scale;
+
+            UINT32 code_point = ellipsis;
+            lookup(&code_point, 1, &_ellipsis_index, &_ellipsis_advance);
+        }
+
+        IDWriteFontFace* face() const { return _face.get(); }
+        FLOAT size() const { return _size; }
+
+        // Bytes of the pages filled so far.
+        size_t memory() const
+        {
+            size_t bytes = 0;
+            for (auto& p : _pages) if (p) bytes += sizeof(page);
+            return bytes;
+        }
+        drawing::distance ascent() const { return _ascent; }
+        drawing::distance line_height() const { return _height; }
+
+        // Fills 'run' with the glyphs of 's', trimmed at a character
+        // boundary and ended with an ellipsis if wider than 'max_width'.
+        // Returns false, leaving 'run' unspecified, if 's' needs shaping or
+        // has characters the font lacks.
+        bool shape(std::wstring_view s, drawing::distance max_width, glyph_run& run)
+        {
+            if (!simple(s) || (s.length() && _ellipsis_index == 0)) return false;
+
+            auto count = s.length();
+            run.indices.resize(count + 1);
+            run.advances.resize(count + 1);
+
+            for (size_t i = 0; i < count; i++)
+            {
+                auto& p = page_of(s[i]);
+                auto index = p.indices[s[i] & 0xff];
+                if (index == 0) return false;
+
+                run.indices[i] = index;
+                run.advances[i] = p.advances[s[i] & 0xff];
+            }
+
+            run.width = 0;
+            run.trimmed = fit(run.advances.data(), count, max_width, run.width) < count;
+
+            if (run.trimmed)
+            {
+                run.width = 0;
+                count = max_width < _ellipsis_advance ? 0 : fit(run.advances.data(),
+                    count, max_width - _ellipsis_advance, run.width);
+
+                if (max_width >= _ellipsis_advance)
+                {
+                    run.indices[count] = _ellipsis_index;
+                    run.advances[count] = _ellipsis_advance;
+                    run.width += _ellipsis_advance;
+                    count++;
+                }
+            }
+
+            run.indices.resize(count);
+            run.advances.resize(count);
+            return true;
+        }
+
+        // Width of 's' on a single line, or a negative value if it needs
+        // shaping.
+        drawing::distance measure(std::wstring_view s)
+        {
+            if (!simple(s)) return -1;
+
+            drawing::distance width = 0;
+            for (auto c : s)
+            {
+                auto& p = page_of(c);
+                if (p.indices[c & 0xff] == 0) return -1;
+                width += p.advances[c & 0xff];
+            }
+            return width;
+        }
+    };
+
+    // The face of a glyph_cache as a glyph_source for a glyph_atlas,
+    // rasterized by DirectWrite.  Its ClearType coverage is averaged to
+    // one byte per pixel.  'glyphs' must outlive it.
+    class dwrite_source : public glyph_source
+    {
+        factory& _factory;
+        glyph_cache& _glyphs;
+        FLOAT _scale;
+        std::vector<BYTE> _texture;
+
+    protected:
+        void lookup(uint32_t c, uint16_t& glyph, float& advance) override
+        {
+            UINT32 code_point = c;
+            DWRITE_GLYPH_METRICS metrics;
+            com::throw_call(_glyphs.face()->GetGlyphIndices(&code_point, 1, &glyph));
+            com::throw_call(_glyphs.face()->GetDesignGlyphMetrics(&glyph, 1, &metrics));
+            advance = metrics.advanceWidth * _scale;
+        }
+
+    public:
+        dwrite_source(factory& f, glyph_cache& glyphs)
+            : _factory(f), _glyphs(glyphs)
+        {
+            DWRITE_FONT_METRICS metrics;
+            _glyphs.face()->GetMetrics(&metrics);
+            _scale = _glyphs.size() / metrics.designUnitsPerEm;
+        }
+
+        float ascent() const override { return _glyphs.ascent(); }
+        float line_height() const override { return _glyphs.line_height(); }
+
+        void rasterize(uint16_t glyph, float offset, glyph_image& out) override
+        {
+            out.left = out.top = out.width = out.height = 0;
+            out.coverage.clear();
+
+            FLOAT advance = 0;
+            DWRITE_GLYPH_OFFSET glyph_offset = { 0, 0 };
+            DWRITE_GLYPH_RUN run = {};
+            run.fontFace = _glyphs.face();
+            run.fontEmSize = _glyphs.size();
+            run.glyphCount = 1;
+            run.glyphIndices = &glyph;
+            run.glyphAdvances = &advance;
+            run.glyphOffsets = &glyph_offset;
+
+            com::com_ptr<IDWriteGlyphRunAnalysis> analysis;
+            com::throw_call(_factory.ptr->CreateGlyphRunAnalysis(&run, 1.0f, nullptr,
+                DWRITE_RENDERING_MODE_CLEARTYPE_NATURAL_SYMMETRIC, DWRITE_MEASURING_MODE_NATURAL,
+                offset, 0.0f, &analysis));
+
+            RECT bounds;
+            com::throw_call(analysis->GetAlphaTextureBounds(DWRITE_TEXTURE_CLEARTYPE_3x1, &bounds));
+            if (bounds.right <= bounds.left || bounds.bottom <= bounds.top) return;
+
+            auto width = bounds.right - bounds.left;
+            auto height = bounds.bottom - bounds.top;
+            _texture.resize(3 * (size_t)width * height);
+            com::throw_call(analysis->CreateAlphaTexture(DWRITE_TEXTURE_CLEARTYPE_3x1,
+                &bounds, _texture.data(), (UINT32)_texture.size()));
+
+            out.left = bounds.left;
+            out.top = -bounds.top;
+            out.width = width;
+            out.height = height;
+            out.coverage.resize((size_t)width * height);
+            for (size_t i = 0; i < out.coverage.size(); i++)
+                out.coverage[i] = (uint8_t)((_texture[3 * i] + _texture[3 * i + 1] + _texture[3 * i + 2]) / 3);
+        }
+    };
+}
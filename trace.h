@@ -0,0 +1,385 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <ostream>
+#include <vector>
+#include "clock.h"
+
+namespace ui
+{
+    // Input a window received, with the time since recording started.
+    // Pointer events carry client coordinates in a and b, wheel events the
+    // raw wheel delta in a, key events the virtual-key code in a, resizes
+    // the client size, and timers which timer fired.  Frame events mark
+    // where a frame was painted.  Pointer, wheel and key events also carry
+    // the modifier keys held at the time.
+    struct input_event
+    {
+        enum kind_type : uint8_t
+        {
+            pointer, mousedown, mouseup, wheel, keydown, resize, timer, frame,
+
+            // The user starting and ending a drag of the window's border or
+            // title bar; version 3 and later.
+            enter_size_move, exit_size_move
+        };
+
+        enum timer_type { window_timer = 0, idle_timer = 1 };
+
+        enum modifier_flags : uint8_t { shift = 1, control = 2 };
+
+        kind_type kind;
+        uint64_t time;  // microseconds
+        int32_t a;
+        int32_t b;
+        uint8_t modifiers;
+
+        static bool has_modifiers(kind_type kind)
+        {
+            return kind <= keydown;
+        }
+    };
+
+    class trace_exception : public std::exception
+    {
+        char const* _reason;
+
+    public:
+        trace_exception(char const* reason) : _reason(reason) {}
+
+        char const* what() const throw() override { return _reason; }
+    };
+
+    // A recorded input stream.  On disk each event is its kind byte, the
+    // time since the previous event, its payload and its modifier keys,
+    // all as varints with zigzag-encoded signed values, after a magic and
+    // version:
+    //
+    //   varint magic, varint version
+    //   { uint8 kind, varint delta_us, [zigzag a], [zigzag b], [uint8 modifiers] }...
+    //
+    // A mouse move costs 4 to 8 bytes.  Version 1 traces have no modifier
+    // bytes and load with none held; traces before version 3 have no
+    // size-move events.
+    class input_trace
+    {
+        static const uint32_t magic = 0x45435254; // "TRCE"
+        static const uint32_t version = 3;
+
+        std::vector<input_event> _events;
+
+        static int payload_of(input_event::kind_type kind)
+        {
+            switch (kind)
+            {
+            case input_event::pointer:
+            case input_event::mousedown:
+            case input_event::mouseup:
+            case input_event::resize:
+                return 2;
+            case input_event::wheel:
+            case input_event::keydown:
+            case input_event::timer:
+                return 1;
+            default:
+                return 0;
+            }
+        }
+
+        static void put(std::vector<uint8_t>& out, uint64_t v)
+        {
+            for (; v >= 0x80; v >>= 7) out.push_back((uint8_t)(v | 0x80));
+            out.push_back((uint8_t)v);
+        }
+
+        static void put_signed(std::vector<uint8_t>& out, int32_t v)
+        {
+            put(out, ((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+        }
+
+        static uint64_t get(uint8_t const*& p, uint8_t const* end)
+        {
+            uint64_t v = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                if (p == end) throw trace_exception("truncated trace");
+                auto byte = *p++;
+                v |= (uint64_t)(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) return v;
+            }
+            throw trace_exception("bad varint in trace");
+        }
+
+        static int32_t get_signed(uint8_t const*& p, uint8_t const* end)
+        {
+            auto v = (uint32_t)get(p, end);
+            return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+        }
+
+    public:
+        typedef std::vector<input_event>::const_iterator iterator;
+
+        void append(input_event const& e) { _events.push_back(e); }
+
+        size_t size() const { return _events.size(); }
+        iterator begin() const { return _events.begin(); }
+        iterator end() const { return _events.end(); }
+
+        void save(std::filesystem::path const& path) const
+        {
+            std::vector<uint8_t> out;
+            put(out, magic);
+            put(out, version);
+
+            uint64_t last = 0;
+            for (auto& e : _events)
+            {
+                out.push_back((uint8_t)e.kind);
+                put(out, e.time - last);
+                last = e.time;
+
+                auto payload = payload_of(e.kind);
+                if (payload > 0) put_signed(out, e.a);
+                if (payload > 1) put_signed(out, e.b);
+                if (input_event::has_modifiers(e.kind)) out.push_back(e.modifiers);
+            }
+
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<char const*>(out.data()), out.size());
+            if (!file) throw trace_exception("cannot write trace");
+        }
+
+        static input_trace load(std::filesystem::path const& path)
+        {
+            std::ifstream file(path, std::ios::binary);
+            if (!file) throw trace_exception("cannot open trace");
+
+            std::vector<uint8_t> in((std::istreambuf_iterator<char>(file)),
+                std::istreambuf_iterator<char>());
+
+            uint8_t const* p = in.data();
+            uint8_t const* end = p + in.size();
+            if (get(p, end) != magic) throw trace_exception("not a trace");
+            auto v = get(p, end);
+            if (v < 1 || v > version) throw trace_exception("unsupported trace version");
+
+            auto last_kind = v < 3 ? input_event::frame : input_event::exit_size_move;
+
+            input_trace t;
+            uint64_t time = 0;
+            while (p != end)
+            {
+                input_event e = {};
+                if (*p > last_kind) throw trace_exception("bad event in trace");
+                e.kind = (input_event::kind_type)*p++;
+                e.time = time += get(p, end);
+
+                auto payload = payload_of(e.kind);
+                if (payload > 0) e.a = get_signed(p, end);
+                if (payload > 1) e.b = get_signed(p, end);
+
+                if (v > 1 && input_event::has_modifiers(e.kind))
+                {
+                    if (p == end) throw trace_exception("truncated trace");
+                    e.modifiers = *p++;
+                }
+
+                t._events.push_back(e);
+            }
+            return t;
+        }
+    };
+
+    // Appends timestamped events to a trace.
+    class trace_recorder
+    {
+        std::chrono::steady_clock::time_point _start;
+        input_trace _trace;
+
+    public:
+        trace_recorder() : _start(std::chrono::steady_clock::now()) {}
+
+        void record(input_event::kind_type kind, int32_t a = 0, int32_t b = 0,
+            uint8_t modifiers = 0)
+        {
+            input_event e;
+            e.kind = kind;
+            e.time = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - _start).count();
+            e.a = a;
+            e.b = b;
+            e.modifiers = modifiers;
+            _trace.append(e);
+        }
+
+        input_trace const& trace() const { return _trace; }
+    };
+
+    // Durations in power-of-two buckets of microseconds, from under 1 us
+    // to over 4 s.
+    class latency_histogram
+    {
+        static const int buckets = 24;
+
+        uint64_t _counts[buckets];
+        uint64_t _total;
+        uint64_t _max;
+        uint64_t _sum;
+
+    public:
+        latency_histogram() : _total(0), _max(0), _sum(0)
+        {
+            for (auto& c : _counts) c = 0;
+        }
+
+        void add(std::chrono::steady_clock::duration d)
+        {
+            auto us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+
+            int bucket = 0;
+            while (bucket < buckets - 1 && (1ull << bucket) <= us) bucket++;
+
+            _counts[bucket]++;
+            _total++;
+            _sum += us;
+            if (us > _max) _max = us;
+        }
+
+        uint64_t count() const { return _total; }
+        uint64_t longest() const { return _max; }
+        uint64_t mean() const { return _total ? _sum / _total : 0; }
+
+        // Upper bound, in microseconds, of the bucket holding the given
+        // fraction of samples.
+        uint64_t percentile(double p) const
+        {
+            auto rank = (uint64_t)(p * _total);
+            uint64_t seen = 0;
+            for (int b = 0; b < buckets; b++)
+            {
+                seen += _counts[b];
+                if (seen > rank) return 1ull << b;
+            }
+            return _max;
+        }
+
+        void write(std::ostream& out, char const* title) const
+        {
+            out << title << ": " << _total << " samples, mean " << mean()
+                << " us, p50 <" << percentile(0.5) << " us, p99 <"
+                << percentile(0.99) << " us, max " << _max << " us\n";
+
+            for (int b = 0; b < buckets; b++)
+            {
+                if (_counts[b] == 0) continue;
+                out << "  <" << (1ull << b) << " us\t" << _counts[b] << "\n";
+            }
+        }
+    };
+
+    struct replay_report
+    {
+        // Time spent painting each frame.
+        latency_histogram frames;
+
+        // From dispatching an input event until the end of the frame that
+        // followed it.
+        latency_histogram input;
+
+        // Steady-state frames painted with the allocation counting hook
+        // enabled, and how many of them allocated; any such frame fails the
+        // replay.  Filled in by the application, which knows which of its
+        // frames are steady.
+        size_t steady_frames;
+        size_t allocating_frames;
+
+        replay_report() : steady_frames(0), allocating_frames(0) {}
+
+        bool failed() const { return allocating_frames != 0; }
+
+        void write(std::ostream& out) const
+        {
+            frames.write(out, "frame");
+            input.write(out, "input to frame");
+
+            if (steady_frames != 0)
+                out << "steady frames: " << steady_frames << ", "
+                    << allocating_frames << " allocating"
+                    << (failed() ? " FAILED" : "") << "\n";
+        }
+    };
+
+    // Feeds a trace to 'sink' in recorded order, as fast as it will go, and
+    // times it.  The sink has the members
+    //
+    //   pointer(a, b)  mousedown(a, b)  mouseup(a, b)  wheel(delta)
+    //   keydown(key)   resize(width, height)  timer(which)  frame()
+    //   enter_size_move()  exit_size_move()
+    //   modifiers(m)   set before each pointer, wheel and key event
+    //   elapsed()      called before each event, once the frame clock
+    //                  shows its recorded time
+    //
+    // so a window replays through its own input callbacks, and the
+    // headless driver (see headless.h) through the same callbacks without
+    // one.  The frame clock is held at the recorded time of each event
+    // meanwhile, so animations, scrolling and idle slices see the recorded
+    // timeline rather than however fast the replay runs.  The histograms
+    // are in real time.
+    template <typename Sink>
+    replay_report replay(input_trace const& trace, Sink& sink)
+    {
+        typedef std::chrono::steady_clock clock;
+
+        replay_report report;
+        std::vector<clock::time_point> waiting;
+
+        auto base = frame_clock::now();
+
+        struct release_clock
+        {
+            ~release_clock() { frame_clock::release(); }
+        } released;
+
+        for (auto& e : trace)
+        {
+            frame_clock::hold(base + std::chrono::microseconds(e.time));
+            sink.elapsed();
+            if (input_event::has_modifiers(e.kind)) sink.modifiers(e.modifiers);
+
+            auto start = clock::now();
+
+            switch (e.kind)
+            {
+            case input_event::pointer: sink.pointer(e.a, e.b); break;
+            case input_event::mousedown: sink.mousedown(e.a, e.b); break;
+            case input_event::mouseup: sink.mouseup(e.a, e.b); break;
+            case input_event::wheel: sink.wheel(e.a); break;
+            case input_event::keydown: sink.keydown((unsigned)e.a); break;
+            case input_event::resize: sink.resize(e.a, e.b); break;
+            case input_event::timer: sink.timer(e.a); break;
+            case input_event::frame: sink.frame(); break;
+            case input_event::enter_size_move: sink.enter_size_move(); break;
+            case input_event::exit_size_move: sink.exit_size_move(); break;
+            }
+
+            if (e.kind == input_event::frame)
+            {
+                auto end = clock::now();
+                report.frames.add(end - start);
+
+                for (auto t : waiting) report.input.add(end - t);
+                waiting.clear();
+            }
+            else if (e.kind != input_event::timer)
+            {
+                waiting.push_back(start);
+            }
+        }
+
+        return report;
+    }
+}
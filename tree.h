@@ -1,90 +1,282 @@
 #pragma once
 
 #include <boost/iterator/iterator_facade.hpp>
-#include <deque>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "geometry.h"
 
 namespace ui
 {
-    template <typename T>
-    struct tree_traits
+    // Views and traversals reach a tree only through an adapter, so trees
+    // kept in other structures are shown as they are instead of being
+    // copied into nodes.  An adapter provides:
+    //
+    //   handle           names one node; cheap to copy, compare and hash
+    //   child_iterator   forward iterator over the children of a node
+    //   root()           node whose children are the top-level rows; it
+    //                    may stand for a whole forest and have no row
+    //   children(h)      pair of child_iterators, in display order
+    //   handle_of(it)    the child 'it' points at
+    //   expandable(h)    false if 'h' certainly has no children
+    //   label(h, text)   replaces 'text' with the text of 'h'
+    //   row_height(h)    height of the row of 'h'
+    //
+    // Views only read through their adapter, so several may share one.
+
+    // Adapter for trees whose nodes hold a 'value' and a 'children'
+    // container of nodes.  Labels come from tree_label(value, text), found
+    // by argument-dependent lookup.
+    template <typename Tree>
+    class tree_traits
     {
-        typedef typename T::value_type value_type;
-        typedef typename T::container container;
+        Tree const& _root;
+
+    public:
+        typedef Tree const* handle;
+        typedef typename Tree::value_type value_type;
+        typedef typename Tree::container container;
+        typedef typename container::const_iterator child_iterator;
+
+        tree_traits(Tree const& root) : _root(root) {}
+
+        handle root() const { return &_root; }
+
+        static value_type const& value_of(handle h) { return h->value; }
+        static container const& children_of(handle h) { return h->children; }
+
+        std::pair<child_iterator, child_iterator> children(handle h) const
+        {
+            return std::make_pair(h->children.begin(), h->children.end());
+        }
 
-        value_type& value_of(T& t) { return t.value(); }
-        container& children_of(T& t) { return t.children(); }
+        handle handle_of(child_iterator it) const { return &*it; }
+        bool expandable(handle h) const { return !h->children.empty(); }
+        void label(handle h, std::wstring& text) const { tree_label(h->value, text); }
+        drawing::distance row_height(handle) const { return 20; }
     };
 
-    template <typename Tree>
-    struct depth_first_tree_iterator
-        : boost::iterator_facade<
-        depth_first_tree_iterator<Tree>,
-        typename Tree::value_type,
-        boost::forward_traversal_tag>
+    // Adapter for a forest given as the parent of every node, as in flat
+    // tables and memory-mapped records: node i's parent is parents[i], or
+    // 'none' at the top level, as are nodes whose parent is out of range.
+    // The parents are not copied and must outlive the adapter; construction
+    // indexes the children, eight bytes per node, in two passes.  Children
+    // are listed in index order.
+    class parent_index_tree
     {
-        typedef typename Tree::container container;
-        typedef typename container::iterator child_iterator;
-        typedef typename Tree::value_type value_type;
+    public:
+        typedef uint32_t handle;
+        typedef uint32_t const* child_iterator;
+        typedef std::function<void(uint32_t, std::wstring&)> label_function;
+
+        static const uint32_t none = uint32_t(-1);
+
+    private:
+        uint32_t const* _parents;
+        uint32_t _count;
+
+        // Children of node i are _children[_offsets[i]] up to
+        // _children[_offsets[i + 1]]; the top level is stored as node
+        // _count.
+        std::vector<uint32_t> _offsets;
+        std::vector<uint32_t> _children;
+
+        label_function _label;
+        drawing::distance _row_height;
+
+        parent_index_tree(parent_index_tree const&);
+        parent_index_tree& operator=(parent_index_tree const&);
+
+        uint32_t slot(handle h) const { return h < _count ? h : _count; }
+
+    public:
+        parent_index_tree(uint32_t const* parents, uint32_t count,
+            label_function label, drawing::distance row_height = 20)
+            : _parents(parents), _count(count),
+            _offsets(size_t(count) + 2, 0), _children(count),
+            _label(label), _row_height(row_height)
+        {
+            for (uint32_t i = 0; i < count; i++)
+                _offsets[slot(parents[i]) + 1]++;
+
+            for (size_t i = 1; i < _offsets.size(); i++)
+                _offsets[i] += _offsets[i - 1];
+
+            std::vector<uint32_t> next(_offsets.begin(), _offsets.end() - 1);
+            for (uint32_t i = 0; i < count; i++)
+                _children[next[slot(parents[i])]++] = i;
+        }
+
+        uint32_t size() const { return _count; }
+
+        handle parent(handle h) const
+        {
+            return h < _count && _parents[h] < _count ? _parents[h] : none;
+        }
+
+        // Bytes of the child index.
+        size_t memory() const
+        {
+            return (_offsets.capacity() + _children.capacity()) * sizeof(uint32_t);
+        }
+
+        handle root() const { return none; }
+
+        std::pair<child_iterator, child_iterator> children(handle h) const
+        {
+            auto s = slot(h);
+            auto base = _children.data();
+            return std::make_pair(base + _offsets[s], base + _offsets[s + 1]);
+        }
+
+        handle handle_of(child_iterator it) const { return *it; }
+
+        bool expandable(handle h) const
+        {
+            auto s = slot(h);
+            return _offsets[s] != _offsets[s + 1];
+        }
+
+        void label(handle h, std::wstring& text) const { _label(h, text); }
+        drawing::distance row_height(handle) const { return _row_height; }
+    };
+
+    // Adapter for a tree of nested ordered maps whose mapped values hold
+    // the map of their children, reached through 'children'.  Rows follow
+    // key order and are labelled with their keys unless a label function
+    // is given.
+    template <typename Map>
+    class map_tree
+    {
+    public:
+        typedef typename Map::value_type value_type;
+        typedef typename Map::mapped_type mapped_type;
+        typedef value_type const* handle;
+        typedef typename Map::const_iterator child_iterator;
+        typedef std::function<void(value_type const&, std::wstring&)> label_function;
 
-        struct range
+    private:
+        Map const& _top;
+        Map mapped_type::* _children;
+        label_function _label;
+        drawing::distance _row_height;
+
+        Map const& children_of(handle h) const
         {
-            child_iterator begin;
-            child_iterator end;
+            return h == nullptr ? _top : h->second.*_children;
+        }
 
-            range(container& c) : begin(c.begin()), end(c.end()) {}
+        static void key_label(std::wstring const& key, std::wstring& text)
+        {
+            text = key;
+        }
 
-            bool is_end() { return begin == end; }
+        template <typename Key>
+        static void key_label(Key const& key, std::wstring& text)
+        {
+            text = std::to_wstring(key);
+        }
+
+    public:
+        map_tree(Map const& top, Map mapped_type::* children,
+            label_function label = label_function(), drawing::distance row_height = 20)
+            : _top(top), _children(children), _label(label), _row_height(row_height) {}
 
-            void increment() { begin++; }
-        };
+        handle root() const { return nullptr; }
 
-        Tree* root;
-        std::deque<range> path;
+        std::pair<child_iterator, child_iterator> children(handle h) const
+        {
+            auto& c = children_of(h);
+            return std::make_pair(c.begin(), c.end());
+        }
 
-        depth_first_tree_iterator(Tree* t) : root(t) {}
+        handle handle_of(child_iterator it) const { return &*it; }
+        bool expandable(handle h) const { return !children_of(h).empty(); }
 
-        value_type& dereference() const
+        void label(handle h, std::wstring& text) const
         {
-            if (path.empty()) return root->value;
-            else return tree_traits<Tree>::value_of(*path.back().begin);
+            if (_label) _label(*h, text);
+            else key_label(h->first, text);
+        }
+
+        drawing::distance row_height(handle) const { return _row_height; }
+    };
+
+    // Pre-order walk over the descendants of a node, yielding handles.
+    template <typename Adapter>
+    class depth_first_tree_iterator
+        : public boost::iterator_facade<
+            depth_first_tree_iterator<Adapter>,
+            typename Adapter::handle,
+            boost::forward_traversal_tag,
+            typename Adapter::handle>
+    {
+        friend class boost::iterator_core_access;
+
+        typedef typename Adapter::handle handle;
+        typedef typename Adapter::child_iterator child_iterator;
+        typedef std::pair<child_iterator, child_iterator> range;
+
+        Adapter const* _tree;
+
+        // Remaining siblings at each level down to the current node; empty
+        // once the walk is over.
+        std::vector<range> _path;
+
+        handle dereference() const
+        {
+            return _tree->handle_of(_path.back().first);
         }
 
         void increment()
         {
-            if (path.empty())
+            auto children = _tree->children(dereference());
+            if (children.first != children.second)
             {
-                path.push_back(range(
-                    tree_traits<Tree>::children_of(root->children())));
+                _path.push_back(children);
+                return;
             }
-            else
+
+            while (!_path.empty())
             {
-                path.back().increment();
-
-                if (path.back().is_end())
-                {
-                    path.pop_back();
-                    if (path.empty()) root = nullptr;
-                    else path.back().increment();
-                }
+                if (++_path.back().first != _path.back().second) return;
+                _path.pop_back();
             }
         }
 
-        bool equal(depth_first_tree_iterator const& other)
+        bool equal(depth_first_tree_iterator const& other) const
+        {
+            return _path == other._path;
+        }
+
+    public:
+        depth_first_tree_iterator() : _tree(nullptr) {}
+
+        depth_first_tree_iterator(Adapter const& tree, handle from) : _tree(&tree)
         {
-            return *this = other;
+            auto children = tree.children(from);
+            if (children.first != children.second) _path.push_back(children);
         }
+
+        // Levels below the node the walk started from; 1 for its children.
+        size_t depth() const { return _path.size(); }
     };
 
-    template <typename Tree>
+    template <typename Adapter>
     struct depth_first_tree_view
     {
-        typedef depth_first_tree_iterator<Tree> iterator;
+        typedef depth_first_tree_iterator<Adapter> iterator;
+        typedef typename Adapter::handle handle;
 
-        Tree& t;
+        Adapter const& tree;
+        handle from;
 
-        depth_first_tree_view(Tree& t) : t(t) {}
+        depth_first_tree_view(Adapter const& t) : tree(t), from(t.root()) {}
+        depth_first_tree_view(Adapter const& t, handle h) : tree(t), from(h) {}
 
-        iterator begin() { return iterator(&t); }
-        iterator end() { return iterator(nullptr); }
+        iterator begin() const { return iterator(tree, from); }
+        iterator end() const { return iterator(); }
     };
 }
\ No newline at end of file
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <iterator>
+#include <memory>
+#include <unordered_set>
+#include <utility>
+#include "model.h"
+#include "shared_tree.h"
+
+namespace model
+{
+    // Keeps a tree_model in step with a shared_tree, on the model's
+    // thread.  sync() compares the latest version with the one mirrored
+    // before and only descends where they do not share a subtree, so its
+    // cost follows the size of the changes rather than of the tree.
+    class tree_mirror
+    {
+        shared_tree& _tree;
+        tree_model& _model;
+        node& _top;
+
+        // Keeps the mirrored version from being reclaimed until the next
+        // sync has compared against it.
+        std::unique_ptr<epoch_domain::guard> _held;
+        frozen_node const* _mirrored;
+
+        static node materialize(frozen_node const& f)
+        {
+            node n(f.name);
+            for (auto c : f.children)
+            {
+                n.children.push_back(materialize(*c));
+                n.children.back().parent = &n;
+            }
+            return n;
+        }
+
+        // 'n' mirrors 'before'; makes it mirror 'after', a later version of
+        // the same node.
+        void update(frozen_node const& before, frozen_node const& after, node& n)
+        {
+            if (before.name != after.name) _model.rename(n, after.name);
+            if (before.children == after.children) return;
+
+            auto& b = before.children;
+            auto& a = after.children;
+            auto it = n.children.begin();
+            size_t i = 0, j = 0;
+
+            // Keys still present, made at the first mismatch.
+            std::unordered_set<uint64_t> kept;
+            bool indexed = false;
+
+            while (i < b.size() && j < a.size())
+            {
+                if (b[i]->key == a[j]->key)
+                {
+                    if (b[i] != a[j]) update(*b[i], *a[j], *it);
+                    ++it;
+                    i++;
+                    j++;
+                    continue;
+                }
+
+                if (!indexed)
+                {
+                    for (auto c : a) kept.insert(c->key);
+                    indexed = true;
+                }
+
+                if (!kept.count(b[i]->key))
+                {
+                    auto next = std::next(it);
+                    _model.remove(n, it, next);
+                    it = next;
+                    i++;
+                }
+                else
+                {
+                    _model.insert(n, it, materialize(*a[j]));
+                    j++;
+                }
+            }
+
+            if (i < b.size()) _model.remove(n, it, n.children.end());
+            for (; j < a.size(); j++) _model.append(n, materialize(*a[j]));
+        }
+
+    public:
+        // Mirrors the tree's root as 'top', which should start without
+        // children.
+        tree_mirror(shared_tree& tree, tree_model& model, node& top)
+            : _tree(tree), _model(model), _top(top), _mirrored(nullptr) {}
+
+        // Brings the model up to the latest version; false if it was.
+        bool sync()
+        {
+            std::unique_ptr<epoch_domain::guard> pin(new epoch_domain::guard(_tree.epochs()));
+            auto latest = _tree.root();
+            if (latest == _mirrored) return false;
+
+            {
+                tree_model::batch b(_model);
+                if (_mirrored == nullptr)
+                {
+                    _model.rename(_top, latest->name);
+                    for (auto c : latest->children) _model.append(_top, materialize(*c));
+                }
+                else update(*_mirrored, *latest, _top);
+            }
+
+            _held = std::move(pin);
+            _mirrored = latest;
+            return true;
+        }
+    };
+}
@@ -7,7 +7,14 @@
 #include <functional>
 #include "drawing.h"
 #include "target.h"
+#include "idle.h"
+#include "trace.h"
+#include "profile.h"
+#include <atomic>
 #include <list>
+#include <memory>
+#include <utility>
+#include <vector>
 
 namespace ui
 {
@@ -28,10 +35,20 @@ namespace ui
     }
 
     static boost::once_flag init_flag;
+
+    // Work to resume later on the UI thread.  It is linked in place rather
+    // than copied, so it has to stay alive until it has run; awaiters keep
+    // theirs in the coroutine frame.
+    struct continuation
+    {
+        continuation* next;
+        void (*resume)(continuation&);
+    };
     
     class window
     {
         HWND _hWnd;
+        DWORD _thread;
         drawing::d2d::hwnd_render_target _hwnd_render_target;
 
         typedef std::list<std::function<bool()> > timer_list;
@@ -40,11 +57,80 @@ namespace ui
         std::function<void(drawing::target&)> _onrender;
         std::function<void(drawing::point&)> _onpointer;
         std::function<void(drawing::point&)> _onmousedown;
+        std::function<void(drawing::point&)> _onmouseup;
+        std::function<void(drawing::distance)> _onwheel;
+        std::function<void(unsigned)> _onkeydown;
+        std::function<void()> _onclose;
+        std::function<void()> _onresized;
         timer_list _ontimer;
 
+        // Idle work runs after each frame in what is left of the frame
+        // budget, and on a low-priority timer while nothing is painted.
+        enum { idle_timer = 1 };
+        idle_scheduler _idle;
+        idle_scheduler::clock::duration _frame_budget;
+
+        // While the user drags the window border, real frames are drawn at
+        // most once per frame budget, or per the time the last one took if
+        // longer; sizes in between show the last frame stretched, and the
+        // resize timer asks for the real frame once it is due.
+        enum { resize_timer = 2 };
+        bool _sizing;
+
+        // Set once a new size arrives while _sizing; a drag that only moves
+        // the window keeps no frames and is not a resize.
+        bool _resized;
+        idle_scheduler::clock::time_point _painted;
+        idle_scheduler::clock::duration _paint_time;
+
+        // Waiting for the next frame to be presented, in order.
+        continuation* _frame_waiters;
+        continuation** _frame_tail;
+
+        // Waiting on a timer set by after(), linked so that closing the
+        // window can resume them.
+        continuation* _timer_waiters;
+
+        bool _closed;
+
+        std::unique_ptr<trace_recorder> _recorder;
+        bool _replaying;
+
+        // While replaying: the modifier keys of the event being replayed,
+        // and continuations waiting for a time on the frame clock instead of
+        // a timer.
+        uint8_t _modifiers;
+        typedef std::pair<idle_scheduler::clock::time_point, continuation*> timed_continuation;
+        std::vector<timed_continuation> _replay_timers;
+
     public:
+        // A window not created yet, so it can be declared before the
+        // factory exists; create() makes it on the calling thread, which
+        // becomes its UI thread.
+        window()
+            : _hWnd(NULL), _thread(0),
+            _frame_budget(std::chrono::milliseconds(16)),
+            _sizing(false), _resized(false), _paint_time(0),
+            _frame_waiters(nullptr), _frame_tail(&_frame_waiters),
+            _timer_waiters(nullptr), _closed(false),
+            _replaying(false), _modifiers(0)
+        {
+        }
+
         window(drawing::factory& f)
+            : _hWnd(NULL), _thread(0),
+            _frame_budget(std::chrono::milliseconds(16)),
+            _sizing(false), _resized(false), _paint_time(0),
+            _frame_waiters(nullptr), _frame_tail(&_frame_waiters),
+            _timer_waiters(nullptr), _closed(false),
+            _replaying(false), _modifiers(0)
+        {
+            create(f);
+        }
+
+        void create(drawing::factory& f)
         {
+            _thread = ::GetCurrentThreadId();
             boost::call_once(register_class, init_flag);
 
             _hWnd = win32::throw_null(::CreateWindowEx(
@@ -76,6 +162,60 @@ namespace ui
             _onmousedown = f;
         }
 
+        // Called when the user stops dragging the window border, before
+        // the frame drawn at the final size.  Dragging the window without
+        // resizing it does not call it.
+        void on_resized(std::function<void()> f)
+        {
+            _onresized = f;
+        }
+
+        // True while the user drags the window border.
+        bool live_resizing() const { return _sizing && _resized; }
+
+        void on_mouseup(std::function<void(drawing::point&)> f)
+        {
+            _onmouseup = f;
+        }
+
+        // Called with the number of lines the wheel turned, positive when
+        // turned away from the user.
+        void on_wheel(std::function<void(drawing::distance)> f)
+        {
+            _onwheel = f;
+        }
+
+        // Called with the virtual-key code of each key pressed.
+        void on_keydown(std::function<void(unsigned)> f)
+        {
+            _onkeydown = f;
+        }
+
+        // Called once the window has been destroyed.  The object must stay
+        // alive until the message being handled returns.
+        void on_close(std::function<void()> f)
+        {
+            _onclose = f;
+        }
+
+        // Set once the window has been destroyed.  Continuations still
+        // waiting on it for a frame or a delay are then resumed at once, so
+        // coroutines check this after each wait and finish rather than
+        // touch what is about to be freed.
+        bool closed() const { return _closed; }
+
+        // State of the modifier keys as of the message being handled, or
+        // as recorded with the event being replayed.
+        bool shift_down() const
+        {
+            return (modifiers() & input_event::shift) != 0;
+        }
+
+        bool control_down() const
+        {
+            return (modifiers() & input_event::control) != 0;
+        }
+
         timer_id on_timer(std::function<bool()> f)
         {
             if (_ontimer.empty())
@@ -93,6 +233,166 @@ namespace ui
                 ::KillTimer(_hWnd, 0);
         }
 
+        // Queues UI-thread work to run in slices between frames.
+        idle_scheduler::task_id post_idle(idle_scheduler::task t,
+            idle_scheduler::priority p = idle_scheduler::normal)
+        {
+            if (_idle.empty())
+                ::SetTimer(_hWnd, idle_timer, USER_TIMER_MINIMUM, NULL);
+
+            return _idle.post(t, p);
+        }
+
+        void cancel_idle(idle_scheduler::task_id id)
+        {
+            _idle.cancel(id);
+        }
+
+        idle_scheduler const& idle() const { return _idle; }
+
+        // Bytes the window holds for drawing: its render target's buffers
+        // and frame arena.
+        size_t memory() const { return _hwnd_render_target.memory(); }
+
+        // Primitives batched in the last frame drawn.
+        drawing::d2d::batch_statistics const& batching() const
+        {
+            return _hwnd_render_target.batching();
+        }
+
+        // Windows created and not yet destroyed, on all threads.  The
+        // application quits when the last one is destroyed.
+        static size_t open()
+        {
+            return open_count().load();
+        }
+
+        // Time a frame, including the idle work after it, should take.
+        void set_frame_budget(idle_scheduler::clock::duration budget)
+        {
+            _frame_budget = budget;
+        }
+
+        // Starts recording the input the window receives, and its frames.
+        void record()
+        {
+            _recorder.reset(new trace_recorder());
+        }
+
+        // Input recorded so far, if recording.
+        input_trace const* recorded() const
+        {
+            return _recorder ? &_recorder->trace() : nullptr;
+        }
+
+        // Feeds a recorded trace through the window's own callbacks and
+        // painting, frame by frame, and reports how long they took.  The
+        // message loop does not run meanwhile, so only the recorded timers
+        // fire, and continuations waiting with after() resume once the
+        // frame clock passes their time.  Modifier keys read their recorded
+        // state.
+        replay_report replay(input_trace const& trace)
+        {
+            struct sink
+            {
+                window& w;
+
+                void modifiers(uint8_t m)
+                {
+                    w._modifiers = m;
+                }
+
+                void elapsed()
+                {
+                    w.run_replay_timers();
+                }
+
+                void pointer(int32_t x, int32_t y)
+                {
+                    drawing::point p((drawing::distance)x, (drawing::distance)y);
+                    if (w._onpointer) w._onpointer(p);
+                }
+
+                void mousedown(int32_t x, int32_t y)
+                {
+                    drawing::point p((drawing::distance)x, (drawing::distance)y);
+                    if (w._onmousedown) w._onmousedown(p);
+                }
+
+                void mouseup(int32_t x, int32_t y)
+                {
+                    drawing::point p((drawing::distance)x, (drawing::distance)y);
+                    if (w._onmouseup) w._onmouseup(p);
+                }
+
+                void wheel(int32_t delta)
+                {
+                    if (w._onwheel) w._onwheel((drawing::distance)delta / WHEEL_DELTA);
+                }
+
+                void keydown(unsigned key)
+                {
+                    if (w._onkeydown) w._onkeydown(key);
+                }
+
+                // Sizes the window so its client area matches; WM_SIZE is
+                // sent before this returns.
+                void resize(int32_t width, int32_t height)
+                {
+                    RECT outer, client;
+                    ::GetWindowRect(w._hWnd, &outer);
+                    ::GetClientRect(w._hWnd, &client);
+
+                    ::SetWindowPos(w._hWnd, NULL, 0, 0,
+                        width + (outer.right - outer.left) - client.right,
+                        height + (outer.bottom - outer.top) - client.bottom,
+                        SWP_NOMOVE | SWP_NOZORDER);
+                }
+
+                void timer(int32_t which)
+                {
+                    w.wm_timer(which == input_event::idle_timer ? idle_timer : 0, 0);
+                }
+
+                void frame()
+                {
+                    w.wm_paint(0, 0);
+                }
+
+                void enter_size_move()
+                {
+                    w.wm_entersizemove(0, 0);
+                }
+
+                void exit_size_move()
+                {
+                    w.wm_exitsizemove(0, 0);
+                }
+            };
+
+            sink s = { *this };
+
+            _replaying = true;
+            auto report = ui::replay(trace, s);
+            _replaying = false;
+
+            // Whatever is still waiting goes back to real timers.
+            auto now = idle_scheduler::clock::now();
+            for (auto& t : _replay_timers)
+            {
+                auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(t.first - now);
+                after(*t.second, wait.count() > 0 ? (UINT)wait.count() : 0);
+            }
+            _replay_timers.clear();
+
+            return report;
+        }
+
+        void close()
+        {
+            ::DestroyWindow(_hWnd);
+        }
+
         void show()
         {
             ShowWindow(_hWnd, SW_SHOWNORMAL);
@@ -109,14 +409,49 @@ namespace ui
             ::SetTimer(_hWnd, 0, timeout, NULL);
         }
 
-        void invoke_async(std::function<void()> f)
+        bool on_ui_thread() const
+        {
+            return ::GetCurrentThreadId() == _thread;
+        }
+
+        // Runs 'c' from the message loop.  May be called from any thread.
+        void post(continuation& c)
+        {
+            ::PostMessage(_hWnd, WM_APP, (WPARAM)&c, 0);
+        }
+
+        // Runs 'c' once the next frame has been presented, and asks for one.
+        void after_frame(continuation& c)
+        {
+            c.next = nullptr;
+            *_frame_tail = &c;
+            _frame_tail = &c.next;
+            redraw();
+        }
+
+        // Runs 'c' after 'ms' milliseconds.  The timer is identified by the
+        // continuation's address.
+        void after(continuation& c, UINT ms)
         {
-            auto fp = new std::function<void()>();
-            *fp = f;
-            ::PostMessage(_hWnd, WM_APP, (UINT_PTR)fp, 0);
+            if (_replaying)
+            {
+                auto due = idle_scheduler::clock::now() + std::chrono::milliseconds(ms);
+                _replay_timers.push_back(timed_continuation(due, &c));
+                return;
+            }
+
+            c.next = _timer_waiters;
+            _timer_waiters = &c;
+            ::SetTimer(_hWnd, (UINT_PTR)&c, ms, NULL);
         }
 
     private:
+        static std::atomic<size_t>& open_count()
+        {
+            static std::atomic<size_t> count(0);
+            return count;
+        }
+
         static void register_class()
         {
             WNDCLASSEX wcex;
@@ -137,6 +472,39 @@ namespace ui
             RegisterClassEx(&wcex);
         }
 
+        uint8_t modifiers() const
+        {
+            if (_replaying) return _modifiers;
+
+            uint8_t m = 0;
+            if (::GetKeyState(VK_SHIFT) & 0x8000) m |= input_event::shift;
+            if (::GetKeyState(VK_CONTROL) & 0x8000) m |= input_event::control;
+            return m;
+        }
+
+        void trace(input_event::kind_type kind, int32_t a = 0, int32_t b = 0)
+        {
+            if (_recorder && !_replaying)
+                _recorder->record(kind, a, b,
+                    input_event::has_modifiers(kind) ? modifiers() : 0);
+        }
+
+        // Resumes the replay timers that are due, earliest first; they may
+        // set more.
+        void run_replay_timers()
+        {
+            auto now = idle_scheduler::clock::now();
+            for (;;)
+            {
+                auto due = std::min_element(_replay_timers.begin(), _replay_timers.end());
+                if (due == _replay_timers.end() || due->first > now) return;
+
+                auto c = due->second;
+                _replay_timers.erase(due);
+                c->resume(*c);
+            }
+        }
+
         static window* instance(HWND hWnd)
         {
             return win32::throw_null(reinterpret_cast<window*>(
@@ -145,13 +513,41 @@ namespace ui
 
         LRESULT wm_paint(WPARAM wParam, LPARAM lParam)
         {
+            TRACE_ZONE("wm_paint");
+
+            auto start = idle_scheduler::clock::now();
+            trace(input_event::frame);
+
             if (_onrender)
             {
                 _hwnd_render_target.begin_draw();
                 _onrender(drawing::target(&_hwnd_render_target));
                 ::ValidateRect(_hWnd, NULL);
-                _hwnd_render_target.end_draw();
+                _hwnd_render_target.end_draw(live_resizing());
+            }
+
+            _painted = idle_scheduler::clock::now();
+            _paint_time = _painted - start;
+
+            // Continuations may wait for another frame while these run.
+            auto waiting = _frame_waiters;
+            _frame_waiters = nullptr;
+            _frame_tail = &_frame_waiters;
+
+            while (waiting != nullptr)
+            {
+                auto c = waiting;
+                waiting = c->next;
+                c->resume(*c);
             }
+
+            auto spent = idle_scheduler::clock::now() - start;
+            if (!_idle.empty() && spent < _frame_budget)
+            {
+                TRACE_ZONE("idle");
+                _idle.run(_frame_budget - spent);
+            }
+
             return 1;
         }
 
@@ -159,13 +555,58 @@ namespace ui
         {
             UINT width = LOWORD(lParam);
             UINT height = HIWORD(lParam);
+            trace(input_event::resize, width, height);
             _hwnd_render_target.resize(width, height);
+
+            if (_sizing)
+            {
+                _resized = true;
+
+                auto interval = (std::max)(_frame_budget, _paint_time);
+                auto since = idle_scheduler::clock::now() - _painted;
+
+                if (since < interval && _hwnd_render_target.present_stretched())
+                {
+                    ::ValidateRect(_hWnd, NULL);
+                    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        interval - since);
+                    ::SetTimer(_hWnd, resize_timer, (UINT)wait.count() + 1, NULL);
+                    return 1;
+                }
+            }
+
             ::InvalidateRect(_hWnd, NULL, false);
             return 1;
         }
 
+        LRESULT wm_entersizemove(WPARAM wParam, LPARAM lParam)
+        {
+            trace(input_event::enter_size_move);
+            _sizing = true;
+            _resized = false;
+            return 0;
+        }
+
+        LRESULT wm_exitsizemove(WPARAM wParam, LPARAM lParam)
+        {
+            trace(input_event::exit_size_move);
+
+            bool resized = _resized;
+            _sizing = _resized = false;
+            if (!resized) return 0;
+
+            ::KillTimer(_hWnd, resize_timer);
+            _hwnd_render_target.drop_frame();
+
+            if (_onresized) _onresized();
+            ::InvalidateRect(_hWnd, NULL, false);
+            return 0;
+        }
+
         LRESULT wm_mousemove(WPARAM wParam, LPARAM lParam)
         {
+            trace(input_event::pointer, GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
+
             if (_onpointer)
             {
                 _onpointer(drawing::point(
@@ -179,6 +620,9 @@ namespace ui
 
         LRESULT wm_lbuttondown(WPARAM wParam, LPARAM lParam)
         {
+            ::SetCapture(_hWnd);
+            trace(input_event::mousedown, GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
+
             if (_onmousedown)
             {
                 _onmousedown(drawing::point(
@@ -190,6 +634,47 @@ namespace ui
             return 0;
         }
 
+        LRESULT wm_lbuttonup(WPARAM wParam, LPARAM lParam)
+        {
+            ::ReleaseCapture();
+            trace(input_event::mouseup, GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
+
+            if (_onmouseup)
+            {
+                drawing::point p(
+                    (drawing::distance)GET_X_LPARAM(lParam),
+                    (drawing::distance)GET_Y_LPARAM(lParam));
+                _onmouseup(p);
+
+                return 1;
+            }
+            return 0;
+        }
+
+        LRESULT wm_mousewheel(WPARAM wParam, LPARAM lParam)
+        {
+            trace(input_event::wheel, GET_WHEEL_DELTA_WPARAM(wParam));
+
+            if (_onwheel)
+            {
+                _onwheel((drawing::distance)GET_WHEEL_DELTA_WPARAM(wParam) / WHEEL_DELTA);
+                return 0;
+            }
+            return DefWindowProc(_hWnd, WM_MOUSEWHEEL, wParam, lParam);
+        }
+
+        LRESULT wm_keydown(WPARAM wParam, LPARAM lParam)
+        {
+            trace(input_event::keydown, (int32_t)wParam);
+
+            if (_onkeydown)
+            {
+                _onkeydown((unsigned)wParam);
+                return 0;
+            }
+            return DefWindowProc(_hWnd, WM_KEYDOWN, wParam, lParam);
+        }
+
         struct timer_helper
         {
             typedef bool result_type;
@@ -199,17 +684,78 @@ namespace ui
         };
         LRESULT wm_timer(WPARAM wParam, LPARAM lParam)
         {
+            TRACE_ZONE("wm_timer");
+
+            if (wParam == idle_timer)
+            {
+                trace(input_event::timer, input_event::idle_timer);
+
+                // WM_TIMER only arrives with the queue otherwise empty.
+                if (!_idle.run(_frame_budget))
+                    ::KillTimer(_hWnd, idle_timer);
+                return 1;
+            }
+            else if (wParam == resize_timer)
+            {
+                ::KillTimer(_hWnd, resize_timer);
+                ::InvalidateRect(_hWnd, NULL, false);
+                return 1;
+            }
+            else if (wParam != 0)
+            {
+                auto c = reinterpret_cast<continuation*>(wParam);
+                ::KillTimer(_hWnd, wParam);
+
+                auto link = &_timer_waiters;
+                while (*link != c) link = &(*link)->next;
+                *link = c->next;
+
+                c->resume(*c);
+                return 1;
+            }
+
+            trace(input_event::timer, input_event::window_timer);
+
             _ontimer.erase(std::remove_if(_ontimer.begin(), _ontimer.end(), 
                 timer_helper()), _ontimer.end());
 
             return 1;
         }
 
+        // Resumes everything still waiting on the window for a frame or a
+        // timer; the window's timers went with it.
+        void resume_waiters()
+        {
+            auto frames = _frame_waiters;
+            _frame_waiters = nullptr;
+            _frame_tail = &_frame_waiters;
+
+            auto timers = _timer_waiters;
+            _timer_waiters = nullptr;
+
+            std::vector<timed_continuation> replay_timers;
+            replay_timers.swap(_replay_timers);
+
+            for (auto list : { frames, timers })
+            {
+                while (list != nullptr)
+                {
+                    auto c = list;
+                    list = c->next;
+                    c->resume(*c);
+                }
+            }
+
+            for (auto& t : replay_timers)
+                t.second->resume(*t.second);
+        }
+
         LRESULT wm_app(WPARAM wParam, LPARAM lParam)
         {
-            auto fp = reinterpret_cast<std::function<void()>*>(wParam);
-            (*fp)();
-            delete fp;
+            TRACE_ZONE("resume on ui");
+
+            auto c = reinterpret_cast<continuation*>(wParam);
+            c->resume(*c);
             return 1;
         }
 
@@ -224,11 +770,18 @@ namespace ui
                     hWnd,
                     GWLP_USERDATA,
                     PtrToUlong(w));
+                open_count()++;
                 return 1;
             }
             else if (message == WM_DESTROY)
             {
-                PostQuitMessage(0);
+                auto w = instance(hWnd);
+                ::SetWindowLongPtrW(hWnd, GWLP_USERDATA, 0);
+
+                if (--open_count() == 0) PostQuitMessage(0);
+                w->_closed = true;
+                w->resume_waiters();
+                if (w->_onclose) w->_onclose();
                 return 1;
             }
             else if (message == WM_PAINT)
@@ -239,6 +792,14 @@ namespace ui
             {
                 return instance(hWnd)->wm_size(wParam, lParam);
             }
+            else if (message == WM_ENTERSIZEMOVE)
+            {
+                return instance(hWnd)->wm_entersizemove(wParam, lParam);
+            }
+            else if (message == WM_EXITSIZEMOVE)
+            {
+                return instance(hWnd)->wm_exitsizemove(wParam, lParam);
+            }
             else if (message == WM_MOUSEMOVE)
             {
                 return instance(hWnd)->wm_mousemove(wParam, lParam);
@@ -247,6 +808,18 @@ namespace ui
             {
                 return instance(hWnd)->wm_lbuttondown(wParam, lParam);
             }
+            else if (message == WM_LBUTTONUP)
+            {
+                return instance(hWnd)->wm_lbuttonup(wParam, lParam);
+            }
+            else if (message == WM_MOUSEWHEEL)
+            {
+                return instance(hWnd)->wm_mousewheel(wParam, lParam);
+            }
+            else if (message == WM_KEYDOWN)
+            {
+                return instance(hWnd)->wm_keydown(wParam, lParam);
+            }
             else if (message == WM_TIMER)
             {
                 return instance(hWnd)->wm_timer(wParam, lParam);